@@ -6,7 +6,23 @@
 #include <math.h>
 #include <time.h>
 #include <string.h>
-#include "read_png.h"
+#include <sys/resource.h>
+#include "textures.h"
+#include "3dtree.h"
+#include "water.h"
+#include "timer.h"
+#include "soil.h"
+#include "tree.h"
+#include "stream.h"
+#include "glcaps.h"
+#include "forest.h"
+#include "frustum.h"
+#include "scene.h"
+#include "loader.h"
+#include "pool.h"
+#include "profile.h"
+#include "offscreen.h"
+#include "config.h"
 
 #ifdef WIN32
 #include <windows.h>
@@ -15,53 +31,69 @@
 #define WIN_X 800
 #define WIN_Y 600
 
-/* in case math.h dose not define PI */
-#ifndef PI
-#define PI 3.141593
-#endif
-
 /* Constants */
 GLfloat container_color[] = {0.0, 0.2, 0.2, 1.0};
 GLfloat water_color[]     = {0.0, 0.0, 0.8, 0.5};
 GLfloat chute_color[]     = {0.5, 0.5, 0.5, 1.0};
-GLfloat tree_color[]      = {0.6, 0.4, 0.0, 1.0}; 
-GLfloat leaf_color[]      = {0.0, 0.5, 0.0, 1.0};
-#define container_radius        5.0
-#define container_height        10.0
-#define door_height             2.5     /* height of door above ground */
-#define chute_length            10.0    /* horizontal length of chute */
-#define tray_size               8.0     /* length of the sides of the tray */
-#define soil_subdivision_depth  5       /* level of subdivision used in soil */
-#define soil_subdivision_drift  0.5     /* bumpiness of soil */
-#define water_particles         20000   /* maximum number of water particles */
-#define water_released          2000    /* max particles released per second */
-#define water_particle_size     4.0     /* size of water particles */
-#define water_particle_volume   0.0002  /* volume of each water particle */
-#define water_start_velocity    1.0     /* pressure in tank */
 #define wood_texture            0
 #define soil_texture            1
-#define gravity                 100.0
+#define sphere_texture          2       /* shading for particle sprites */
+#define sphere_texture_size     64
+#define field_of_view           45.0
 #define viewer_radius           30      /* distance of viewer from center */
 #define camera_increment        (PI/100)/* distance camera moves per keypress */
+#define water_slabs             8       /* pieces of the chute culled apart */
+#define frame_rate_default      60      /* frames a second while animating */
+#define offscreen_steps         2       /* simulation steps per frame */
+#define golden_tolerance        16      /* channel difference let through */
+#define golden_wrong_pixels     0.001   /* fraction of pixels let through */
+#define golden_slowdown         1.25    /* median frame time let through */
+#define path_length             256
 
 /* Variables */
-GLfloat container_water_level = container_height - 1.0;
-GLfloat tray_water_level = 0.0;
-GLfloat door_frame[3][3];
-GLuint  textures[2];
-GLfloat doory = 0.0;
-GLfloat water[water_particles][7];
-GLfloat tray_water_particle_volume;
-int     active_particles = 0;
+GLuint  textures[3];
+int     water_sprites = 0;      /* draw particles as shaded point sprites */
+int     window_height = WIN_Y;
 GLfloat viewer_position[3];
 GLfloat viewer_y_angle = -1.0;
 GLfloat viewer_x_angle = -0.5;
-
-/* Display lists */
-GLuint container;
-GLuint tray;
-GLuint chute;
-GLuint soil;
+struct sim_clock sim_clock;
+struct stream water_stream;     /* particle positions for the GL */
+GLfloat render_alpha = 1.0;     /* position of the display between steps */
+GLfloat prev_container_water_level = container_height - 1.0;
+GLfloat prev_tray_water_level = 0.0;
+struct tree tray_tree;          /* grows with the water in the tray */
+struct frustum view_frustum;    /* this frame's view, in world coordinates */
+int frame_rate = frame_rate_default; /* 0 for as many as can be drawn */
+int animating = 0;              /* stepping the simulation and redrawing */
+double next_frame;              /* when a capped frame rate draws again */
+
+/* The scene and its objects */
+struct scene scene;
+int container;                  /* edges of the container and door frame */
+int door_panel, door_edge;
+int tray;
+int chute;
+int soil;
+int ground;                     /* soil around the apparatus in forest mode */
+int tank_water, tray_water;
+
+/* Made by the loader's threads, for the GL thread to upload */
+struct texture_job {
+  char const *file_name;
+  int texture;
+  struct texture_image image;
+} texture_jobs[] = {{"wood.png", wood_texture}, {"soil.png", soil_texture}};
+struct soil_mesh soil_mesh;
+int embedded_assets = 1;        /* textures from the program, not files */
+char const *profile_file = NULL; /* where the profile goes at exit */
+
+/* Headless runs */
+int offscreen_frames = 0;       /* to draw without a window, 0 for a window */
+int shot_interval = 0;          /* frames between those saved */
+char const *shot_dir = ".";     /* where they are saved */
+char const *golden_dir = NULL;  /* what they should look like */
+char const *summary_file = NULL; /* where a line of the run's results goes */
 
 /* Callbacks */
 void display(void);
@@ -71,17 +103,36 @@ void timef(int);
 void mouse(int, int, int, int);
 void keyboard(unsigned char, int, int);
 void idle(void);
+void tick(int);
+void at_exit(void);
+
+/* Headless runs */
+void run_offscreen(void);
+void script_frame(int);
+int compare_frame_times(double);
+void write_summary(double const *, double const *);
 
 /* Initialisation */
 void init_textures(void);
+void upload_textures(void);
+void init_sphere_texture(void);
+int sprites_supported(void);
 void init_container(void);
+void init_door(void);
 void init_tray(void);
 void init_chute(void);
 void init_soil(void);
-void init_water(void);
+void init_ground(void);
+void init_water_surfaces(void);
 void init_tree(void);
 
+/* Loader jobs */
+void load_texture(void *);
+int find_embedded_texture(struct texture_image *, char const *);
+void build_soil(void *);
+
 /* Drawing functions */
+void draw(void);
 void water_in_tank(void);
 void water_in_tray(void);
 void door(void);
@@ -89,22 +140,101 @@ void water_on_chute(void);
 void tree(void);
 
 /* helper functions */
-void divide_triangle(int, GLfloat[3], GLfloat[3], GLfloat[3]);
-GLfloat *cross_product(GLfloat[3], GLfloat[3], GLfloat[3]);
-void normalise(GLfloat[3]);
-GLfloat *difference(GLfloat[3], GLfloat[3], GLfloat[3]);
-float gettime();
-void calculate_water(void);
-void new_particle(GLfloat[6]);
-float randf(void);
+void wake(void);
+int simulate(int);
+GLfloat interpolate(GLfloat, GLfloat);
+struct scene_material material(GLfloat const *, GLfloat, GLuint);
+GLuint *put_hexagon(GLuint *, GLuint);
+GLuint *put_panel(GLuint *, GLuint);
 
 int main(int argc, char *argv[]) {
   GLfloat ambient_light[] = {0.5, 0.5, 0.5, 1.0};
+  int threads = 1, trees = 0;
+  char const *error;
+  char *value;
+  unsigned long seed = (unsigned long) time(NULL);
+  double start;
+  int i;
+
+  /* without a window there is no GLUT */
+  for(i = 1; i < argc; i++)
+    if(strcmp(argv[i], "-offscreen") == 0) break;
+  if(i == argc)
+    glutInit(&argc, argv);
+
+  /* options left over by glutInit */
+  for(i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+      seed = strtoul(argv[++i], NULL, 0);
+    } else if(strcmp(argv[i], "-forest") == 0 && i + 1 < argc) {
+      trees = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-textures") == 0 && i + 1 < argc &&
+              (strcmp(argv[i+1], "embedded") == 0 ||
+               strcmp(argv[i+1], "disk") == 0)) {
+      embedded_assets = strcmp(argv[++i], "embedded") == 0;
+    } else if(strcmp(argv[i], "-particles") == 0 && i + 1 < argc &&
+              atoi(argv[i+1]) > 0) {
+      water_particles = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-config") == 0 && i + 1 < argc) {
+      config_load(argv[++i]);
+    } else if(strcmp(argv[i], "-set") == 0 && i + 1 < argc &&
+              (value = strchr(argv[i+1], '=')) != NULL) {
+      *value++ = '\0';
+      if((error = config_set(argv[++i], value)) != NULL) {
+        fprintf(stderr, "ERROR: %s = %s: %s\n", argv[i], value, error);
+        exit(1);
+      }
+    } else if(strcmp(argv[i], "-sph") == 0) {
+      water_interact = 1;
+    } else if(strcmp(argv[i], "-fps") == 0 && i + 1 < argc &&
+              atoi(argv[i+1]) >= 0) {
+      frame_rate = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-profile") == 0 && i + 1 < argc) {
+      profile_file = argv[++i];
+    } else if(strcmp(argv[i], "-offscreen") == 0 && i + 1 < argc &&
+              atoi(argv[i+1]) > 0) {
+      offscreen_frames = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-shots") == 0 && i + 1 < argc &&
+              atoi(argv[i+1]) > 0) {
+      shot_interval = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-out") == 0 && i + 1 < argc) {
+      shot_dir = argv[++i];
+    } else if(strcmp(argv[i], "-golden") == 0 && i + 1 < argc) {
+      golden_dir = argv[++i];
+    } else if(strcmp(argv[i], "-summary") == 0 && i + 1 < argc) {
+      summary_file = argv[++i];
+    } else {
+      fprintf(stderr, "Usage: %s [-threads n] [-seed n] [-forest trees] "
+              "[-textures embedded|disk]\n"
+              "  [-particles n] [-config file] [-set name=value] [-sph] "
+              "[-fps n]\n"
+              "  [-profile file.csv|file.json] [-offscreen frames "
+              "[-shots every] [-out dir]\n"
+              "  [-golden dir] [-summary file.csv]]\n", argv[0]);
+      exit(1);
+    }
+  }
 
-  glutInit(&argc, argv);
-  glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
-  glutInitWindowSize(WIN_X, WIN_Y);
-  glutCreateWindow("Assessment 2000");
+  /* the textures are loaded and the soil built while the window comes up,
+   * each job on a loader thread of its own; only the soil's subdivision
+   * uses the pool.  The soil is placed by the door frame, so that is
+   * worked out before any job starts. */
+  init_door_frame();
+  for(i = 0; i < sizeof(texture_jobs)/sizeof(*texture_jobs); i++)
+    loader_run(load_texture, &texture_jobs[i]);
+  init_pool(threads);
+  loader_run(build_soil, &seed);
+
+  if(offscreen_frames > 0) {
+    offscreen_init(WIN_X, WIN_Y);
+    reshape(WIN_X, WIN_Y);
+  } else {
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+    glutInitWindowSize(WIN_X, WIN_Y);
+    glutCreateWindow("Assessment 2000");
+  }
 
   glClearColor(0.5, 0.5, 0.5, 1.0); /* Grey background */
   glShadeModel(GL_SMOOTH);
@@ -117,18 +247,35 @@ int main(int argc, char *argv[]) {
   glEnable(GL_BLEND);
   /* enable textures */
   glEnable(GL_TEXTURE_2D);
-
-  /* initialise random numbers */
-  srand((unsigned int) time(NULL));
+  /* water particles are drawn as points */
+  glPointSize(water_particle_size);
+  stream_init(&water_stream);
+  water_sprites = sprites_supported();
 
   /* Initialise */
   init_textures();
+  scene_init(&scene);
   init_container();
+  init_door();
   init_tray();
   init_chute();
-  init_soil();
-  init_water();
+  init_water_surfaces();
+  init_water(water_particles, threads, seed);
   init_tree();
+  if(trees > 0) {
+    start = timer_now();
+    init_forest(trees, seed);
+    printf("forest: %d trees of %d shapes grown in %.3f s\n", forest_trees,
+           forest_shapes, timer_now() - start);
+    init_ground();
+  }
+  /* only the uploads wait for the loader */
+  loader_wait();
+  upload_textures();
+  init_soil();
+  atexit(at_exit);
+  if(offscreen_frames > 0)
+    run_offscreen();
 
   /* register callbacks */
   glutDisplayFunc(display);
@@ -136,7 +283,8 @@ int main(int argc, char *argv[]) {
   glutSpecialFunc(special);
   glutMouseFunc(mouse);
   glutKeyboardFunc(keyboard);
-  glutIdleFunc(idle);
+  /* until the door is opened it will go back to sleep */
+  wake();
 
   glutMainLoop();
 
@@ -144,9 +292,21 @@ int main(int argc, char *argv[]) {
 }
 
 void display() {
+  draw();
+  profile_begin(profile_swap);
+  glFlush();
+  glutSwapBuffers();
+  profile_end(profile_swap);
+}
+
+/* Draw a frame, leaving it to be shown */
+void draw() {
   GLfloat light_position[] = {20.0, 100.0, 50.0, 1.0};
   GLfloat light_color[] = {1.0, 1.0, 1.0, 1.0};
+  int apparatus[5];
 
+  profile_end(profile_frame);
+  profile_begin(profile_frame);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   /* calculate viewpoint */
@@ -162,6 +322,7 @@ void display() {
   gluLookAt(viewer_position[0], viewer_position[1], viewer_position[2],
             0.0, (door_height+2.0)/2.0, door_frame[0][2]+chute_length/2,
             0.0, 1.0, 0.0);
+  frustum_from_gl(&view_frustum);
 
   /* Place the lights */
   glLightfv(GL_LIGHT0, GL_AMBIENT_AND_DIFFUSE, light_color);
@@ -169,371 +330,456 @@ void display() {
   glLightfv(GL_LIGHT0, GL_POSITION, light_position);
   glEnable(GL_LIGHT0);
 
-  glCallList(container);
+  /* the solid parts of the apparatus, leaving out those not in view */
+  apparatus[0] = container;
+  apparatus[1] = tray;
+  apparatus[2] = chute;
+  apparatus[3] = soil;
+  apparatus[4] = ground;
+  profile_begin(profile_apparatus);
+  scene_draw(&scene, &view_frustum, apparatus, (forest_trees > 0) ? 5 : 4);
+  profile_end(profile_apparatus);
+  profile_begin(profile_door);
   door();
-  glCallList(tray);
-  glCallList(chute);
-  glCallList(soil);
+  profile_end(profile_door);
+  if(forest_trees > 0) {
+    profile_begin(profile_forest);
+    forest_draw();
+    profile_end(profile_forest);
+  }
+  profile_begin(profile_water_tray);
   water_in_tray();
+  profile_end(profile_water_tray);
+  profile_begin(profile_water_chute);
   water_on_chute();
+  profile_end(profile_water_chute);
+  profile_begin(profile_water_tank);
   water_in_tank();
+  profile_end(profile_water_tank);
+  profile_begin(profile_tree);
   tree();
-
-  glFlush();
-  glutSwapBuffers();
-  return;
+  profile_end(profile_tree);
 }
 
 void reshape(int w, int h) {
   glMatrixMode(GL_PROJECTION);
   glLoadIdentity();
-  gluPerspective(45.0, (float)w/(float)h, 2.0, 400.0);
+  gluPerspective(field_of_view, (float)w/(float)h, 2.0, 400.0);
   glMatrixMode(GL_MODELVIEW);
   glLoadIdentity();
   glViewport(0, 0, w, h);
+  window_height = h;
 }
 
+/* The texture objects are named at once, for the materials, and the loaded
+ * textures are put in them later by upload_textures() */
 void init_textures() {
-  GLbyte target_texture[128][128][3];
-  unsigned int width, height;
-  GLbyte * source_texture;
-
-  glGenTextures(2, textures); /* create the texture objects */
-
-  glBindTexture(GL_TEXTURE_2D, textures[wood_texture]);
-  /* load and scale the texture */
-  read_png("wood.png", &width, &height, &source_texture);
-  if(0 != gluScaleImage(GL_RGB, width, height, GL_UNSIGNED_BYTE,
-        source_texture, 128, 128, GL_UNSIGNED_BYTE, target_texture)) {
-    fprintf(stderr, "ERROR: could not scale texture");
-    exit(1);
-  }
-  free(source_texture);
-  source_texture = NULL;
-
-  /* apply the texture */
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 128, 128,
-               0, GL_RGB, GL_UNSIGNED_BYTE, target_texture);
-
-  glBindTexture(GL_TEXTURE_2D, textures[soil_texture]);
-  /* load and scale the texture */
-  read_png("soil.png", &width, &height, &source_texture);
-  if(0 != gluScaleImage(GL_RGB, width, height, GL_UNSIGNED_BYTE,
-        source_texture, 128, 128, GL_UNSIGNED_BYTE, target_texture)) {
-    fprintf(stderr, "ERROR: could not scale texture");
-    exit(1);
-  }
-  free(source_texture);
-  source_texture = NULL;
+  glGenTextures(3, textures); /* create the texture objects */
+  init_sphere_texture();
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-  /* apply the texture */
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 128, 128, 0, GL_RGB, GL_UNSIGNED_BYTE,
-               target_texture);
+void upload_textures() {
+  int i;
 
+  for(i = 0; i < sizeof(texture_jobs)/sizeof(*texture_jobs); i++) {
+    texture_upload(&texture_jobs[i].image,
+                   textures[texture_jobs[i].texture]);
+    texture_release(&texture_jobs[i].image);
+  }
   glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-void door() {
-  GLfloat black[] = {0.0, 0.0, 0.0, 1.0};
-  GLfloat door[3][3];
-  
-  memcpy(door, door_frame, sizeof(GLfloat)*9);
-  door[0][1] += doory;
-  door[1][1] += doory;
-  door[2][1] += doory;
-  /* move the door forward slightly to stop it being obscured by the frame */
-  door[0][2] += 0.05;
-  door[1][2] += 0.05;
-  door[2][2] += 0.05;
-
-  /* Set the material to black */
-  glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, black);
-  glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, black);
-  glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 50);  
-  
-  /* draw the door */
-  glBegin(GL_LINES);
-    glVertex3fv(door[2]);
-    glVertex3f(door[2][0], container_height, door[2][2]);
-  glEnd();
+/* Cooked at texture_size with their mip chains, so from the disk usually
+ * only mapped */
+void load_texture(void *arg) {
+  struct texture_job * const job = (struct texture_job *) arg;
 
-  glLoadName(1);  /* for selection purposes */
-  glBegin(GL_TRIANGLES);
-    glNormal3f(0.0, 0.0, 1.0);
-    glVertex3fv(door[0]);
-    glVertex3fv(door[1]);
-    glVertex3fv(door[2]);
-  glEnd();
+  if(embedded_assets && find_embedded_texture(&job->image, job->file_name))
+    return;
+  texture_load(&job->image, job->file_name, texture_size);
+}
+
+/* Point the image at the texture cooked into the program from the PNG.
+ * Returns 0 when there is none. */
+int find_embedded_texture(struct texture_image *t, char const *file_name) {
+  int i;
 
+  for(i = 0; i < embedded_texture_count; i++) {
+    if(strcmp(embedded_textures[i].name, file_name) == 0 &&
+       embedded_textures[i].size == texture_size) {
+      memset(t, 0, sizeof(*t));
+      t->size = embedded_textures[i].size;
+      t->levels = embedded_textures[i].levels;
+      t->data = embedded_textures[i].data;
+      return 1;
+    }
+  }
+  return 0;
 }
 
-void water_on_chute() {
-  register int i;
+/* Sprites need point sprites, and point parameters to size them with
+ * distance */
+int sprites_supported() {
+  return gl_version_at_least(2, 0) ||
+         (gl_has_extension("GL_ARB_point_sprite") &&
+          (gl_version_at_least(1, 4) ||
+           gl_has_extension("GL_ARB_point_parameters")));
+}
 
-  /* Set the material to water */
-  glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, water_color);
-  glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, water_color);
-  glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 100);
-
-  glBegin(GL_POINTS);
-    for(i = 0; i < water_particles; i++) {
-      if(water[i][6]) {
-        glVertex3fv(water[i]);
-        /*glPushMatrix();
-        glTranslatef(water[i][0], water[i][1], water[i][2]);
-        glutSolidSphere(water_particle_size, 10, 10);
-        glPopMatrix();*/
-      }
+/* A lit sphere seen head on: the luminance is the shading for a light above
+ * and to the right of the viewer, and the alpha cuts out the disc.  Drawn
+ * on a point sprite it makes the particle look round. */
+void init_sphere_texture() {
+  GLubyte texture[sphere_texture_size][sphere_texture_size][2];
+  GLfloat light[3] = {0.4, 0.6, 0.7}, half[3];
+  GLfloat u, v, r2, nz, diffuse, specular, shade;
+  int row, col;
+
+  normalise(light);
+  /* half way between the light and the viewer for the highlight */
+  half[0] = light[0];
+  half[1] = light[1];
+  half[2] = light[2] + 1.0;
+  normalise(half);
+
+  for(row = 0; row < sphere_texture_size; row++) {
+    for(col = 0; col < sphere_texture_size; col++) {
+      /* row 0 is the top of the sprite */
+      u = 2.0 * (col + 0.5) / sphere_texture_size - 1.0;
+      v = 1.0 - 2.0 * (row + 0.5) / sphere_texture_size;
+      r2 = u*u + v*v;
+      nz = (r2 < 1.0) ? sqrt(1.0 - r2) : 0.0;
+
+      diffuse = u*light[0] + v*light[1] + nz*light[2];
+      if(diffuse < 0.0) diffuse = 0.0;
+      specular = u*half[0] + v*half[1] + nz*half[2];
+      specular = (specular > 0.0) ? pow(specular, 40.0) : 0.0;
+      shade = 0.35 + 0.65*diffuse + specular;
+      if(shade > 1.0) shade = 1.0;
+
+      texture[row][col][0] = (GLubyte) (255 * shade);
+      /* soften the edge over about a texel */
+      shade = (1.0 - sqrt(r2)) * sphere_texture_size / 2;
+      texture[row][col][1] = (shade <= 0.0) ? 0 : 
+                             (shade >= 1.0) ? 255 : (GLubyte) (255 * shade);
     }
-  glEnd();
+  }
+
+  glBindTexture(GL_TEXTURE_2D, textures[sphere_texture]);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, 
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  /* the sprites are only a few pixels across, so they need the mip chain */
+  gluBuild2DMipmaps(GL_TEXTURE_2D, GL_LUMINANCE_ALPHA, sphere_texture_size,
+                    sphere_texture_size, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE,
+                    texture);
 }
 
-void water_in_tray() {
+void door() {
+  static GLfloat placed = -1.0;   /* door position the vertices are for */
 
-  glPushMatrix();
-    glTranslatef(0.0, 0.0, door_frame[0][2]+chute_length+tray_size/2);
+  if(doory != placed) {
+    GLfloat * const panel = scene_vertices(&scene, door_panel);
+    GLfloat * const edge = scene_vertices(&scene, door_edge);
+    int i;
 
+    for(i = 0; i < 3; i++)
+      panel[scene_vertex_floats*i + 1] = door_frame[i][1] + doory;
+    edge[1] = door_frame[2][1] + doory;
+    placed = doory;
+  }
+
+  scene_draw(&scene, &view_frustum, &door_edge, 1);
+  glLoadName(1);  /* for selection purposes */
+  scene_draw(&scene, &view_frustum, &door_panel, 1);
+}
+
+void water_on_chute() {
+  register int i;
+  /* step back from the last simulated position to the display time */
+  GLfloat const back = (1.0 - render_alpha) * sim_step;
+  /* particles run from the door over the chute and fall into the tray */
+  GLfloat const z0 = door_frame[0][2];
+  GLfloat const slab_length = (chute_length + tray_size) / water_slabs;
+  int shown[water_slabs], any = 0, count = 0, s;
+  struct box slab, reach;
+  GLfloat *vertices;
+
+  if(water.count == 0) return;
+
+  /* the chute and tray, stretched to hold any particles beyond them;
+   * those off either end are counted in the end slabs */
+  reach.min[0] = door_frame[0][0];
+  reach.max[0] = door_frame[1][0];
+  reach.min[1] = 0.0;
+  reach.max[1] = container_height;
+  reach.min[2] = z0;
+  reach.max[2] = z0 + chute_length + tray_size;
+  for(i = 0; i < water.count; i++) {
+    GLfloat const p[3] = {water.x[i] - water.vx[i]*back,
+                          water.y[i] - water.vy[i]*back,
+                          water.z[i] - water.vz[i]*back};
+    int a;
+
+    for(a = 0; a < 3; a++) {
+      if(p[a] < reach.min[a]) reach.min[a] = p[a];
+      if(p[a] > reach.max[a]) reach.max[a] = p[a];
+    }
+  }
+
+  /* which pieces of the chute are in view */
+  slab.min[0] = reach.min[0] - water_particle_size/25.0;
+  slab.max[0] = reach.max[0] + water_particle_size/25.0;
+  slab.min[1] = reach.min[1] - water_particle_size/25.0;
+  slab.max[1] = reach.max[1] + water_particle_size/25.0;
+  for(s = 0; s < water_slabs; s++) {
+    slab.min[2] = (s == 0) ? reach.min[2] : z0 + s*slab_length;
+    slab.max[2] = (s == water_slabs - 1) ? reach.max[2]
+                                         : z0 + (s+1)*slab_length;
+    shown[s] = frustum_box(&view_frustum, &slab);
+    any |= shown[s];
+  }
+  if(!any) return;
+
+  if(water_sprites) {
+    /* pixel size of a particle one unit from the viewer; the GL divides
+     * by the distance */
+    GLfloat const attenuation[3] = {0.0, 0.0, 1.0};
+    GLfloat const sprite_size = water_particle_size/25.0 * window_height / 
+                                (2.0 * tan(field_of_view/2 * PI/180));
+
+    /* the sphere texture does the shading, so no lighting is needed */
+    glDisable(GL_LIGHTING);
+    glColor4fv(water_color);
+    glBindTexture(GL_TEXTURE_2D, textures[sphere_texture]);
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glEnable(GL_POINT_SPRITE);
+    glTexEnvi(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
+    glPointSize(sprite_size);
+    glPointParameterfv(GL_POINT_DISTANCE_ATTENUATION, attenuation);
+    glPointParameterf(GL_POINT_SIZE_MIN, 1.0);
+    /* translucent, so do not hide the particles behind */
+    glDepthMask(GL_FALSE);
+  } else {
     /* Set the material to water */
     glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, water_color);
     glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, water_color);
     glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 100);
-    
-    glBegin(GL_QUADS);
-      glNormal3f(0.0, 1.0, 0.0);
-      glVertex3f(tray_size/2, tray_water_level, tray_size/2);
-      glVertex3f(tray_size/2, tray_water_level, -tray_size/2);
-      glVertex3f(-tray_size/2, tray_water_level, -tray_size/2);
-      glVertex3f(-tray_size/2, tray_water_level, tray_size/2);
-    glEnd();
-  glPopMatrix();
+  }
+
+  /* pack the positions into this frame's part of the vertex buffer */
+  vertices = (GLfloat *) stream_map(&water_stream, 
+                                    water.count * 3 * sizeof(GLfloat));
+  for(i = 0; i < water.count; i++) {
+    GLfloat const z = water.z[i] - water.vz[i]*back;
+
+    s = (int) ((z - z0) / slab_length);
+    if(s < 0) s = 0;
+    if(s >= water_slabs) s = water_slabs - 1;
+    if(!shown[s]) continue;
+    vertices[3*count]   = water.x[i] - water.vx[i]*back;
+    vertices[3*count+1] = water.y[i] - water.vy[i]*back;
+    vertices[3*count+2] = z;
+    count++;
+  }
+
+  /* and draw them all at once */
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(3, GL_FLOAT, 0, stream_unmap(&water_stream));
+  glDrawArrays(GL_POINTS, 0, count);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  stream_done(&water_stream);
+
+  if(water_sprites) {
+    GLfloat const no_attenuation[3] = {1.0, 0.0, 0.0};
+
+    glDepthMask(GL_TRUE);
+    glPointParameterfv(GL_POINT_DISTANCE_ATTENUATION, no_attenuation);
+    glPointSize(water_particle_size);
+    glDisable(GL_POINT_SPRITE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glEnable(GL_LIGHTING);
+  }
+}
+
+void water_in_tray() {
+  static GLfloat placed = -1.0;   /* level the vertices are for */
+  GLfloat const level = interpolate(prev_tray_water_level, tray_water_level);
+
+  if(level != placed) {
+    GLfloat * const v = scene_vertices(&scene, tray_water);
+    int i;
+
+    for(i = 0; i < 4; i++)
+      v[scene_vertex_floats*i + 1] = level;
+    placed = level;
+  }
+  scene_draw(&scene, &view_frustum, &tray_water, 1);
+}
+
+/* Indices of the six sided top or bottom of the water in the tank */
+GLuint *put_hexagon(GLuint *index, GLuint first) {
+  int i;
+
+  for(i = 1; i < 5; i++) {
+    *index++ = first;
+    *index++ = first + i;
+    *index++ = first + i + 1;
+  }
+  return index;
+}
+
+GLuint *put_panel(GLuint *index, GLuint first) {
+  *index++ = first;
+  *index++ = first + 1;
+  *index++ = first + 2;
+  *index++ = first;
+  *index++ = first + 2;
+  *index++ = first + 3;
+  return index;
 }
 
 void water_in_tank() {
+  static GLfloat placed = -1.0;   /* level the vertices are for */
+  static int order = -1;          /* back panel, and whether the top is last */
+  GLuint const first = scene.objects[tank_water].first_vertex;
   float theta;
-  int i, back, drawn;
+  int i, back, drawn, above;
   float PI_6, PI2_6;
-  GLfloat x, z;
-  GLfloat top[6][3], bottom[6][3], normals[6][3];
+  GLfloat level;
+  GLuint *index;
 
+  level = interpolate(prev_container_water_level, container_water_level);
   PI_6 = PI/6;
   PI2_6 = 2*PI_6;
 
-  glPushMatrix();
-    glRotatef(-30.0, 0.0, 1.0, 0.0);
+  if(level != placed) {
+    GLfloat * const v = scene_vertices(&scene, tank_water);
 
-    /* Generate the vertices for the container */
+    /* the top, and the top edges of the walls */
     for(i = 0; i < 6; i++) {
-      theta = i * PI2_6;
-      
-      /*
-       * Normals for the planes
-       * e.g. normals[0] is for the plane formed by 
-       * top[0], top[1], bottom[0] and bottom[1]
-       */
-      normals[i][0] = sin(theta + PI_6);
-      normals[i][1] = 0.0;
-      normals[i][2] = cos(theta + PI_6);
-      
-      x = container_radius * sin(theta);
-      z = container_radius * cos(theta);
-      top[i][0] = x;
-      top[i][1] = container_water_level;
-      top[i][2] = z;
-      bottom[i][0] = x;
-      bottom[i][1] = 0.0;
-      bottom[i][2] = z;
+      v[scene_vertex_floats*(6 + i) + 1] = level;
+      v[scene_vertex_floats*(12 + 4*i + 1) + 1] = level;
+      v[scene_vertex_floats*(12 + 4*i + 2) + 1] = level;
     }
-    
-    /* Set the material to water */
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, water_color);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, water_color);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 100);
+    placed = level;
+  }
 
-    /* Draw the bottom */
-    glBegin(GL_POLYGON);
-      glNormal3f(0.0, -1.0, 0.0);
-      for(i = 0; i < 6; i++)
-        glVertex3fv(bottom[i]);
-    glEnd();
-
-    if(viewer_position[1] < container_water_level) {
-      /* Draw the top */
-      glBegin(GL_POLYGON);
-        glNormal3f(0.0, 1.0, 0.0);
-        for(i = 0; i < 6; i++)
-          glVertex3fv(top[i]);
-      glEnd();
+  /* Calculate which is the back of the container for blending purposes */
+  if(viewer_position[2] == 0.0)
+    theta = (viewer_position[0] < 0.0) ? -PI/2 : PI/2;
+  else 
+    theta = atan(viewer_position[0] / viewer_position[2]);
+  if(viewer_position[2] < 0.0) theta += PI;
+  theta -= PI_6;
+  if(theta < 0.0) theta += 2*PI;
+
+  back = (int) (theta/(PI2_6)) + 4;
+  if(back > 5) back -= 6;
+  above = viewer_position[1] >= level;
+
+  /* put the faces in order from back to front */
+  if(2*back + above != order) {
+    index = scene_indices(&scene, tank_water);
+    index = put_hexagon(index, first);
+    if(!above)
+      index = put_hexagon(index, first + 6);
+
+    i = (back == 0) ? 5 : back - 1;
+    /* the three back panels and the front right panel */
+    for(drawn = 0; drawn < 4; drawn++, i++) {
+      if(i > 5) i -= 6;
+      index = put_panel(index, first + 12 + 4*i);
     }
-
-    /* Calculate which is the back of the container for blending purposes */
-    if(viewer_position[2] == 0.0)
-      theta = (viewer_position[0] < 0.0) ? -PI/2 : PI/2;
-    else 
-      theta = atan(viewer_position[0] / viewer_position[2]);
-    if(viewer_position[2] < 0.0) theta += PI;
-    theta -= PI_6;
-    if(theta < 0.0) theta += 2*PI;
-
-    back = (int) (theta/(PI2_6)) + 4;
-    if(back > 5) back -= 6;
-    
-    /* Draw the walls */
-    glBegin(GL_QUADS);
-      i = (back == 0) ? 5 : back - 1;
-      /* Draw the three back panels and the front right panel */
-      for(drawn = 0; drawn < 4; drawn++, i++) {
-        if(i > 5) i -= 6;
-        glNormal3fv(normals[i]);
-        glVertex3fv(bottom[i]);
-        glVertex3fv(top[i]);
-        if(i == 5) {
-          glVertex3fv(top[0]);
-          glVertex3fv(bottom[0]);
-        } else {
-          glVertex3fv(top[i+1]);
-          glVertex3fv(bottom[i+1]);
-        }
-      }
-      /* Draw the front left panel and then the front panel */
-      if(i > 4) {
-        i -= 5;
-      } else {
-        i += 1;
-      }
-
-      for(; drawn < 6; drawn++, i--) {
-        if(i < 0) i += 6;
-        glNormal3fv(normals[i]);
-        glVertex3fv(bottom[i]);
-        glVertex3fv(top[i]);
-        if(i == 5) {
-          glVertex3fv(top[0]);
-          glVertex3fv(bottom[0]);
-        } else {
-          glVertex3fv(top[i+1]);
-          glVertex3fv(bottom[i+1]);
-        }
-      }
-    glEnd();
-
-    if(viewer_position[1] >= container_water_level) {
-      /* Draw the top */
-      glBegin(GL_POLYGON);
-        glNormal3f(0.0, 1.0, 0.0);
-        for(i = 0; i < 6; i++)
-          glVertex3fv(top[i]);
-      glEnd();
+    /* the front left panel and then the front panel */
+    if(i > 4) {
+      i -= 5;
+    } else {
+      i += 1;
+    }
+    for(; drawn < 6; drawn++, i--) {
+      if(i < 0) i += 6;
+      index = put_panel(index, first + 12 + 4*i);
     }
-  
-  glPopMatrix();
 
+    if(above)
+      index = put_hexagon(index, first + 6);
+    order = 2*back + above;
+  }
+
+  scene_draw(&scene, &view_frustum, &tank_water, 1);
 }
 
-void init_water() {
+void init_container() {
+  GLfloat const up[3] = {0.0, 1.0, 0.0};
+  struct scene_material const m = material(container_color, 10, 0);
+  GLuint first;
+  float theta;
   int i;
 
-  tray_water_particle_volume = 1 * water_particle_volume / 
-    (container_water_level - door_frame[0][1]);
+  container = scene_object(&scene, GL_LINES, &m);
 
-  glPointSize(water_particle_size);
-  for(i = 0; i < water_particles; i++)
-    water[i][6] = 0;
+  /* the corners of the container, turned by 30 degrees */
+  for(i = 0; i < 6; i++) {
+    theta = i * 2.0 * PI / 6.0 - PI / 6.0;
+    scene_vertex(&scene, container_radius * sin(theta), 0.0,
+                 container_radius * cos(theta), up, 0.0, 0.0);
+    scene_vertex(&scene, container_radius * sin(theta), container_height,
+                 container_radius * cos(theta), up, 0.0, 0.0);
+  }
+  /* and the edges of its sides */
+  first = scene.objects[container].first_vertex;
+  for(i = 0; i < 6; i++) {
+    int const next = (i + 1) % 6;
+    scene_line(&scene, first + 2*i, first + 2*i + 1);
+    scene_line(&scene, first + 2*i, first + 2*next);
+    scene_line(&scene, first + 2*i + 1, first + 2*next + 1);
+  }
 
-  return;
+  /* the door frame, worked out before the loader jobs started */
+  first = scene_vertex(&scene, door_frame[0][0], door_frame[0][1],
+                       door_frame[0][2], up, 0.0, 0.0);
+  scene_vertex(&scene, door_frame[1][0], door_frame[1][1], door_frame[1][2],
+               up, 0.0, 0.0);
+  scene_vertex(&scene, door_frame[2][0], door_frame[2][1], door_frame[2][2],
+               up, 0.0, 0.0);
+  scene_line(&scene, first, first + 1);
+  scene_line(&scene, first + 1, first + 2);
+  scene_line(&scene, first + 2, first);
 }
 
-void init_container() {
-  float theta;
+/* The door slides up its frame, so door() moves its vertices */
+void init_door() {
+  GLfloat const black[] = {0.0, 0.0, 0.0, 1.0};
+  GLfloat const forward[3] = {0.0, 0.0, 1.0};
+  struct scene_material const m = material(black, 50, 0);
+  /* move the door forward slightly to stop it being obscured by the frame */
+  GLfloat const z = door_frame[0][2] + 0.05;
+  GLuint first;
   int i;
-  GLfloat x, z;
-  GLfloat top[6][3], bottom[6][3];
-  GLfloat doorz, door_half_width, door_frame_height;
-
-  container = glGenLists(1);
-  if(container != 0) {
-    
-    glNewList(container, GL_COMPILE);
-      glPushMatrix();
-        glRotatef(-30.0, 0.0, 1.0, 0.0);
-
-        /* Generate the vertices for the container */
-        for(i = 0; i < 6; i++) {
-          theta = i * 2.0 * PI / 6.0;
-          
-          x = container_radius * sin(theta);
-          z = container_radius * cos(theta);
-          top[i][0] = x;
-          top[i][1] = container_height;
-          top[i][2] = z;
-          bottom[i][0] = x;
-          bottom[i][1] = 0.0;
-          bottom[i][2] = z;
-        }
-        
-        /* Set the material properties */
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE,
-                     container_color);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, container_color);
-        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 10);
-        
-        /* Draw the container */
-        for(i = 0; i < 6; i++) {
-          glBegin(GL_LINE_LOOP);
-            glVertex3fv(bottom[i]);
-            glVertex3fv(top[i]);
-            if(i == 5) {
-              glVertex3fv(top[0]);
-              glVertex3fv(bottom[0]);
-            } else {
-              glVertex3fv(top[i+1]);
-              glVertex3fv(bottom[i+1]);
-            }
-          glEnd();
-        }
-        
-      glPopMatrix();
-
-      /* calculate the door frame */
-      doorz = container_radius * cos(PI/6);
-      door_half_width = 0.5 * container_radius * sin(PI/6);
-      door_frame[0][0] = -door_half_width;
-      door_frame[0][1] = door_height;
-      door_frame[0][2] = doorz;
-      door_frame[1][0] = door_half_width;
-      door_frame[1][1] = door_height;
-      door_frame[1][2] = doorz;
-      door_frame[2][0] = 0.0;
-      door_frame_height = sqrt((2*door_half_width)*(2*door_half_width) - 
-                               door_half_width*door_half_width);
-      door_frame[2][1] = door_height + door_frame_height;
-      door_frame[2][2] = doorz;
-
-      /* draw the door frame */
-      glBegin(GL_LINE_LOOP);
-        glVertex3fv(door_frame[0]);
-        glVertex3fv(door_frame[1]);
-        glVertex3fv(door_frame[2]);
-      glEnd();
-
-    glEndList();
-    
-  } else {
-    
-    fprintf(stderr, "ERROR: Unable to allocate a display list for the container");
-    exit(1);
-  }
+
+  door_panel = scene_object(&scene, GL_TRIANGLES, &m);
+  first = scene.objects[door_panel].first_vertex;
+  for(i = 0; i < 3; i++)
+    scene_vertex(&scene, door_frame[i][0], door_frame[i][1], z, forward,
+                 0.0, 0.0);
+  scene_triangle(&scene, first, first + 1, first + 2);
+
+  /* the rope it hangs from */
+  door_edge = scene_object(&scene, GL_LINES, &m);
+  first = scene_vertex(&scene, door_frame[2][0], door_frame[2][1], z,
+                       forward, 0.0, 0.0);
+  scene_vertex(&scene, door_frame[2][0], container_height, z, forward,
+               0.0, 0.0);
+  scene_line(&scene, first, first + 1);
 }
 
 void init_tray() {
   int i;
+  GLfloat const tray_z = door_frame[0][2] + chute_length + tray_size/2;
   GLfloat tray_vertices[8][3] = {{tray_size/2, 0.0, tray_size/2},
                                  {-tray_size/2, 0.0, tray_size/2},
                                  {-tray_size/2, 0.0, -tray_size/2},
@@ -547,179 +793,215 @@ void init_tray() {
                                 {0.0, 0.0, -1.0},
                                 {1.0, 0.0, 0.0},
                                 {0.0, -1.0, 0.0}};
-                                 
-  tray = glGenLists(1);
-  if(tray != 0) {
-    glNewList(tray, GL_COMPILE);
-
-      glPushMatrix();
-      
-        glTranslatef(0.0, 0.0, 
-                     door_frame[0][2] + (chute_length) + tray_size/2);
-
-        /* select the wood texture */
-        glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-        glBindTexture(GL_TEXTURE_2D, textures[wood_texture]);
-
-        /* draw the sides */
-        glBegin(GL_QUADS);
-          for(i = 0; i < 4; i++) {
-            glNormal3fv(tray_normals[i]);
-            glTexCoord2i(1,0); glVertex3fv(tray_vertices[i]);
-            glTexCoord2i(1,1); glVertex3fv(tray_vertices[i+4]);
-            if(i == 3) {
-              glTexCoord2i(0,1); glVertex3fv(tray_vertices[4]);
-              glTexCoord2i(0,0); glVertex3fv(tray_vertices[0]);
-            } else {
-              glTexCoord2i(0,1); glVertex3fv(tray_vertices[i+5]);
-              glTexCoord2i(0,0); glVertex3fv(tray_vertices[i+1]);
-            }
-          }
-        glEnd();
-
-
-        /* draw the bottom */
-        glBegin(GL_POLYGON);
-          glNormal3fv(tray_normals[4]);
-          glTexCoord2i(1,0); glVertex3fv(tray_vertices[0]);
-          glTexCoord2i(0,0); glVertex3fv(tray_vertices[1]);
-          glTexCoord2i(0,1); glVertex3fv(tray_vertices[2]);
-          glTexCoord2i(1,1); glVertex3fv(tray_vertices[3]);
-        glEnd();
-
-        /* disable textures */
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-      glPopMatrix();
-
-    glEndList();
-  } else {
-    fprintf(stderr, "ERROR: unable to allocate a display list for the tray");
-    exit(1);
+  struct scene_material const m = material(NULL, 0, textures[wood_texture]);
+  GLuint first;
+
+  for(i = 0; i < 8; i++)
+    tray_vertices[i][2] += tray_z;
+
+  tray = scene_object(&scene, GL_TRIANGLES, &m);
+
+  /* the sides */
+  for(i = 0; i < 4; i++) {
+    int const next = (i + 1) % 4;
+    GLfloat const *n = tray_normals[i];
+    GLfloat *v;
+
+    v = tray_vertices[i];
+    first = scene_vertex(&scene, v[0], v[1], v[2], n, 1.0, 0.0);
+    v = tray_vertices[i+4];
+    scene_vertex(&scene, v[0], v[1], v[2], n, 1.0, 1.0);
+    v = tray_vertices[next+4];
+    scene_vertex(&scene, v[0], v[1], v[2], n, 0.0, 1.0);
+    v = tray_vertices[next];
+    scene_vertex(&scene, v[0], v[1], v[2], n, 0.0, 0.0);
+    scene_quad(&scene, first, first + 1, first + 2, first + 3);
   }
+
+  /* the bottom */
+  first = scene_vertex(&scene, tray_vertices[0][0], tray_vertices[0][1],
+                       tray_vertices[0][2], tray_normals[4], 1.0, 0.0);
+  scene_vertex(&scene, tray_vertices[1][0], tray_vertices[1][1],
+               tray_vertices[1][2], tray_normals[4], 0.0, 0.0);
+  scene_vertex(&scene, tray_vertices[2][0], tray_vertices[2][1],
+               tray_vertices[2][2], tray_normals[4], 0.0, 1.0);
+  scene_vertex(&scene, tray_vertices[3][0], tray_vertices[3][1],
+               tray_vertices[3][2], tray_normals[4], 1.0, 1.0);
+  scene_quad(&scene, first, first + 1, first + 2, first + 3);
 }
 
 void init_chute() {
   GLfloat h, l, normal_length;
+  GLfloat normal[3];
+  struct scene_material const m = material(chute_color, 80, 0);
+  GLuint first;
 
-  chute = glGenLists(1);
-  if(chute != 0) {
-    glNewList(chute, GL_COMPILE);
-
-      /* set the material properties */
-      glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, chute_color);
-      glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, chute_color);
-      glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 80);
-
-      /* draw the chute */
-      h = (door_frame[0][1]-2.0);
-      l = chute_length;
-      normal_length = sqrt(h*h + l*l);
-
-      glBegin(GL_QUADS);
-        glNormal3f(0.0, l/normal_length, h/normal_length);
-        glVertex3f(door_frame[0][0], door_frame[0][1], door_frame[0][2]);
-        glVertex3f(door_frame[0][0], 2.0, door_frame[0][2] + chute_length);
-        glVertex3f(door_frame[1][0], 2.0, door_frame[1][2] + chute_length);
-        glVertex3f(door_frame[1][0], door_frame[1][1], door_frame[1][2]);
-
-        glNormal3f(-1.0, 0.0, 0.0);
-        glVertex3f(door_frame[0][0], door_frame[0][1]+0.5, door_frame[0][2]);
-        glVertex3f(door_frame[0][0], door_frame[0][1], door_frame[0][2]);
-        glVertex3f(door_frame[0][0], 2.0, door_frame[0][2] + chute_length);
-        glVertex3f(door_frame[0][0], 2.5, door_frame[0][2] + chute_length);
-
-        glNormal3f(1.0, 0.0, 0.0);
-        glVertex3f(door_frame[1][0], door_frame[1][1]+0.5, door_frame[1][2]);
-        glVertex3f(door_frame[1][0], door_frame[1][1], door_frame[1][2]);
-        glVertex3f(door_frame[1][0], 2.0, door_frame[1][2] + chute_length);
-        glVertex3f(door_frame[1][0], 2.5, door_frame[1][2] + chute_length);
-      glEnd();
-    glEndList();
-  } else {
-    fprintf(stderr, "ERROR: unable to allocate a display list for the chute");
-    exit(1);
-  }
+  chute = scene_object(&scene, GL_TRIANGLES, &m);
+
+  h = (door_frame[0][1]-2.0);
+  l = chute_length;
+  normal_length = sqrt(h*h + l*l);
+
+  /* the slope */
+  normal[0] = 0.0;
+  normal[1] = l/normal_length;
+  normal[2] = h/normal_length;
+  first = scene_vertex(&scene, door_frame[0][0], door_frame[0][1],
+                       door_frame[0][2], normal, 0.0, 0.0);
+  scene_vertex(&scene, door_frame[0][0], 2.0, door_frame[0][2] + chute_length,
+               normal, 0.0, 0.0);
+  scene_vertex(&scene, door_frame[1][0], 2.0, door_frame[1][2] + chute_length,
+               normal, 0.0, 0.0);
+  scene_vertex(&scene, door_frame[1][0], door_frame[1][1], door_frame[1][2],
+               normal, 0.0, 0.0);
+  scene_quad(&scene, first, first + 1, first + 2, first + 3);
+
+  /* the left side */
+  normal[0] = -1.0;
+  normal[1] = normal[2] = 0.0;
+  first = scene_vertex(&scene, door_frame[0][0], door_frame[0][1]+0.5,
+                       door_frame[0][2], normal, 0.0, 0.0);
+  scene_vertex(&scene, door_frame[0][0], door_frame[0][1], door_frame[0][2],
+               normal, 0.0, 0.0);
+  scene_vertex(&scene, door_frame[0][0], 2.0, door_frame[0][2] + chute_length,
+               normal, 0.0, 0.0);
+  scene_vertex(&scene, door_frame[0][0], 2.5, door_frame[0][2] + chute_length,
+               normal, 0.0, 0.0);
+  scene_quad(&scene, first, first + 1, first + 2, first + 3);
+
+  /* the right side */
+  normal[0] = 1.0;
+  first = scene_vertex(&scene, door_frame[1][0], door_frame[1][1]+0.5,
+                       door_frame[1][2], normal, 0.0, 0.0);
+  scene_vertex(&scene, door_frame[1][0], door_frame[1][1], door_frame[1][2],
+               normal, 0.0, 0.0);
+  scene_vertex(&scene, door_frame[1][0], 2.0, door_frame[1][2] + chute_length,
+               normal, 0.0, 0.0);
+  scene_vertex(&scene, door_frame[1][0], 2.5, door_frame[1][2] + chute_length,
+               normal, 0.0, 0.0);
+  scene_quad(&scene, first, first + 1, first + 2, first + 3);
 }
 
+void build_soil(void *seed) {
+  int i;
+
+  soil_build(&soil_mesh, tray_size, 1.0, soil_subdivision_depth,
+             *(unsigned long *) seed);
+  /* move it into the tray */
+  for(i = 0; i < soil_mesh.vertex_count; i++)
+    soil_mesh.vertices[scene_vertex_floats*i + 2] +=
+      door_frame[0][2] + chute_length + tray_size/2;
+}
+
+/* Add the soil build_soil() made to the scene */
 void init_soil() {
-  GLfloat p1[3], p2[3], p3[3], p4[3], centre[3] = {0.0, 1.0, 0.0};
-
-  soil = glGenLists(1);
-  if(soil != 0) {
-    glNewList(soil, GL_COMPILE);
-      
-      glPushMatrix();
-        glTranslatef(0.0, 0.0, door_frame[0][2]+chute_length+tray_size/2);
-    
-        p1[0] = p2[0] = p1[2] = p4[2] = -tray_size/2;
-        p3[0] = p4[0] = p2[2] = p3[2] = tray_size/2;
-        p1[1] = p2[1] = p3[1] = p4[1] = 1.0;
-        
-        /* select the soil texture */
-        glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-        glBindTexture(GL_TEXTURE_2D, textures[soil_texture]);
-        
-        glBegin(GL_TRIANGLES);      
-          divide_triangle(soil_subdivision_depth, p1, p2, centre);
-          divide_triangle(soil_subdivision_depth, p2, p3, centre);
-          divide_triangle(soil_subdivision_depth, p3, p4, centre);
-          divide_triangle(soil_subdivision_depth, p4, p1, centre);
-        glEnd();
-        
-        glBindTexture(GL_TEXTURE_2D, 0);
-      glPopMatrix();
-    glEndList();
+  struct scene_material const m = material(NULL, 0, textures[soil_texture]);
 
-  } else {
-    fprintf(stderr, "ERROR: unable to allocate a display list for the chute");
-    exit(1);
-  }
+  soil = scene_object(&scene, GL_TRIANGLES, &m);
+  scene_mesh(&scene, soil_mesh.vertices, soil_mesh.vertex_count,
+             soil_mesh.indices, soil_mesh.index_count);
+  soil_free(&soil_mesh);
 }
 
-void divide_triangle(int depth, GLfloat p1[3], GLfloat p2[3], GLfloat p3[3]) {
-  GLfloat new_point[3];
-  GLfloat normal[3], t1[3], t2[3];
-  GLfloat ydrift;
+/* A square of soil under the forest, just below the tray and container */
+void init_ground() {
+  GLfloat const r = forest_radius + 5.0;
+  /* the soil texture repeats every tray_size */
+  GLfloat const repeats = 2 * r / tray_size;
+  GLfloat const up[3] = {0.0, 1.0, 0.0};
+  GLfloat const x = forest_centre[0], y = -0.05, z = forest_centre[2];
+  struct scene_material const m = material(NULL, 0, textures[soil_texture]);
+  GLuint first;
+
+  ground = scene_object(&scene, GL_TRIANGLES, &m);
+  first = scene_vertex(&scene, x - r, y, z + r, up, 0.0, 0.0);
+  scene_vertex(&scene, x + r, y, z + r, up, repeats, 0.0);
+  scene_vertex(&scene, x + r, y, z - r, up, repeats, repeats);
+  scene_vertex(&scene, x - r, y, z - r, up, 0.0, repeats);
+  scene_quad(&scene, first, first + 1, first + 2, first + 3);
+}
 
-  if(depth == 0) {
-    /* calculate the normal */
-    difference(p1,p2,t1);
-    difference(p2,p3,t2);
-    normalise(cross_product(t1,t2,normal));
-    /* draw the triangle */
-    glNormal3fv(normal);
-    glTexCoord2f(0.0, 0.0); glVertex3fv(p1);
-    glTexCoord2f(1.0, 0.0); glVertex3fv(p2);
-    glTexCoord2f(0.5, 1.0); glVertex3fv(p3);
-  } else {
-    /* further sub-divide */
-    new_point[0] = (p1[0] + p2[0] + p3[0])/3;
-    ydrift = soil_subdivision_drift * 2*(randf()-0.5);
-    new_point[1] = (p1[1] + p2[1] + p3[1])/3 + ydrift;
-    new_point[2] = (p1[2] + p2[2] + p3[2])/3;
-    divide_triangle(depth-1, p1, p2, new_point);
-    divide_triangle(depth-1, p1, new_point, p3);
-    divide_triangle(depth-1, new_point, p2, p3);
+/* The water in the tank and the tray.  Their levels change as it flows,
+ * so water_in_tank() and water_in_tray() move their vertices. */
+void init_water_surfaces() {
+  GLfloat const up[3] = {0.0, 1.0, 0.0}, down[3] = {0.0, -1.0, 0.0};
+  GLfloat const tray_z = door_frame[0][2] + chute_length + tray_size/2;
+  struct scene_material const m = material(water_color, 100, 0);
+  GLfloat corners[6][2], normal[3];
+  GLuint first;
+  float theta;
+  int i, k;
+
+  /* turned by 30 degrees, like the container */
+  for(i = 0; i < 6; i++) {
+    theta = i * 2.0 * PI / 6.0 - PI / 6.0;
+    corners[i][0] = container_radius * sin(theta);
+    corners[i][1] = container_radius * cos(theta);
+  }
+
+  /* the bottom, the top and then the walls; water_in_tank() orders them */
+  tank_water = scene_object(&scene, GL_TRIANGLES, &m);
+  for(i = 0; i < 6; i++)
+    scene_vertex(&scene, corners[i][0], 0.0, corners[i][1], down, 0.0, 0.0);
+  for(i = 0; i < 6; i++)
+    scene_vertex(&scene, corners[i][0], 0.0, corners[i][1], up, 0.0, 0.0);
+  for(i = 0; i < 6; i++) {
+    k = (i + 1) % 6;
+    normal[0] = sin(i * 2.0 * PI / 6.0);
+    normal[1] = 0.0;
+    normal[2] = cos(i * 2.0 * PI / 6.0);
+    first = scene_vertex(&scene, corners[i][0], 0.0, corners[i][1], normal,
+                         0.0, 0.0);
+    scene_vertex(&scene, corners[i][0], 0.0, corners[i][1], normal, 0.0, 0.0);
+    scene_vertex(&scene, corners[k][0], 0.0, corners[k][1], normal, 0.0, 0.0);
+    scene_vertex(&scene, corners[k][0], 0.0, corners[k][1], normal, 0.0, 0.0);
   }
+  /* room for the two hexagons and six panels */
+  for(i = 0; i < 20; i++)
+    scene_triangle(&scene, first, first, first);
+
+  tray_water = scene_object(&scene, GL_TRIANGLES, &m);
+  first = scene_vertex(&scene, tray_size/2, 0.0, tray_z + tray_size/2, up,
+                       0.0, 0.0);
+  scene_vertex(&scene, tray_size/2, 0.0, tray_z - tray_size/2, up, 0.0, 0.0);
+  scene_vertex(&scene, -tray_size/2, 0.0, tray_z - tray_size/2, up, 0.0, 0.0);
+  scene_vertex(&scene, -tray_size/2, 0.0, tray_z + tray_size/2, up, 0.0, 0.0);
+  scene_quad(&scene, first, first + 1, first + 2, first + 3);
 }
 
 void init_tree()
 {
-
+  tree_init(&tray_tree, 2.0);
 }
 
 void keyboard(unsigned char key, int x, int y) {
+  wake();
   switch(key) {
   case 'o':
     /* open the door */
     glutTimerFunc(0, timef, 0);
     break;
+  case 'f':
+    /* toggle fast forward */
+    sim_clock.fast_forward = !sim_clock.fast_forward;
+    break;
+  case 's':
+    /* toggle between shaded sprites and flat points for the water */
+    if(sprites_supported())
+      water_sprites = !water_sprites;
+    glutPostRedisplay();
+    break;
+  case 'p':
+    /* where the frames have been going */
+    profile_report(stdout);
+    water_report(stdout);
+    break;
   }
   return;
 }
 
 void special(int key, int x, int y) {
+  wake();
   switch(key) {
   case GLUT_KEY_UP:
     if(viewer_x_angle > -PI/2+camera_increment) 
@@ -747,23 +1029,249 @@ void timef(int timer)
     doory += 0.05;
     glutTimerFunc(500.0, timef, 0);
     glutPostRedisplay();
+    wake();
   }
 }
 
 void idle() {
-  static clock_t t_old=0;
-  clock_t t_new, elapsed;
+  /* run the simulation in fixed steps, catching up with the wall clock */
+  if(simulate(sim_clock_steps(&sim_clock))) {
+    render_alpha = sim_clock_alpha(&sim_clock);
+    glutPostRedisplay();
+    return;
+  }
+  /* nothing is moving, so wait for the user with no callback to spin on */
+  animating = 0;
+  glutIdleFunc(NULL);
+}
 
-  t_new=clock();
-  elapsed=t_new-t_old;
-  t_old = t_new;
-  printf("FPS: %.1f  \r", (float) CLOCKS_PER_SEC / (float) elapsed);
+/* idle() at a capped frame rate, on a timer instead of every time round
+ * the main loop */
+void tick(int timer) {
+  double now;
+
+  idle();
+  if(!animating) return;
+  now = timer_now();
+  next_frame += 1.0 / frame_rate;
+  /* after a slow frame start again from now rather than rushing */
+  if(next_frame < now) next_frame = now;
+  glutTimerFunc((unsigned int) ((next_frame - now) * 1000.0), tick, 0);
+}
 
-  if(doory > 0.0 && 
-     (container_water_level > door_frame[0][1] || active_particles > 0)) {
-    calculate_water();
-    glutPostRedisplay();
+/* Start animating after sleeping, taking up the simulation from now */
+void wake() {
+  if(animating) return;
+  animating = 1;
+  sim_clock_start(&sim_clock);
+  if(frame_rate > 0) {
+    next_frame = timer_now();
+    glutTimerFunc(0, tick, 0);
+  } else
+    glutIdleFunc(idle);
+}
+
+/* Run the simulation for some fixed steps, if the water is moving at all.
+ * Returns 0 when it is not. */
+int simulate(int steps) {
+  if(doory <= 0.0 ||
+     (container_water_level <= door_frame[0][1] && water.count == 0))
+    return 0;
+  profile_begin(profile_simulate);
+  for(; steps > 0; steps--) {
+    prev_container_water_level = container_water_level;
+    prev_tray_water_level = tray_water_level;
+    calculate_water(sim_step);
+  }
+  profile_end(profile_simulate);
+  return 1;
+}
+
+static int compare_doubles(void const *a, void const *b) {
+  double const x = *(double const *) a, y = *(double const *) b;
+
+  return (x > y) - (x < y);
+}
+
+/* The time below which a share p of the sorted times fall */
+static double percentile(double const *times, int n, double p) {
+  return times[(int) (p * (n - 1) + 0.5)];
+}
+
+/* Draw offscreen_frames frames along a scripted path with no window.  The
+ * simulation moves on offscreen_steps steps a frame, whatever the clock
+ * says, so runs with the same seed and threads draw the same frames.  Every
+ * shot_interval-th frame is saved in shot_dir and, given golden_dir,
+ * compared with the one saved there, as are the times taken to draw the
+ * frames.  Given summary_file, a line for the run is added to it. */
+void run_offscreen() {
+  double * const times = (double *) malloc(2 * offscreen_frames *
+                                           sizeof(double));
+  long const allowed = golden_wrong_pixels * WIN_X * WIN_Y;
+  char name[path_length];
+  FILE *file;
+  double *steps;         /* the same, simulating too */
+  double start, drawn;
+  long wrong;
+  int frame, failed = 0;
+
+  if(!times) {
+    fprintf(stderr, "ERROR: unable to allocate the frame times\n");
+    exit(1);
+  }
+  steps = times + offscreen_frames;
+  if(shot_interval == 0)
+    shot_interval = offscreen_frames;
+
+  for(frame = 0; frame < offscreen_frames; frame++) {
+    start = timer_now();
+    script_frame(frame);
+    drawn = timer_now();
+    draw();
+    glFinish();
+    times[frame] = (timer_now() - drawn) * 1000.0;
+    steps[frame] = (timer_now() - start) * 1000.0;
+    if((frame + 1) % shot_interval != 0) continue;
+
+    snprintf(name, sizeof(name), "%s/frame-%04d.png", shot_dir, frame);
+    offscreen_save(name);
+    if(!golden_dir) continue;
+    snprintf(name, sizeof(name), "%s/frame-%04d.png", golden_dir, frame);
+    wrong = offscreen_compare(name, golden_tolerance);
+    if(wrong < 0) {
+      printf("frame %d: no golden frame in %s\n", frame, name);
+      failed = 1;
+    } else if(wrong > allowed) {
+      printf("frame %d: %ld pixels differ from %s\n", frame, wrong, name);
+      failed = 1;
+    }
+  }
+
+  snprintf(name, sizeof(name), "%s/frame-times.csv", shot_dir);
+  file = fopen(name, "w");
+  if(file) {
+    fprintf(file, "frame,ms\n");
+    for(frame = 0; frame < offscreen_frames; frame++)
+      fprintf(file, "%d,%.4f\n", frame, times[frame]);
+    fclose(file);
+  } else
+    fprintf(stderr, "WARNING: unable to write %s\n", name);
+
+  qsort(times, offscreen_frames, sizeof(*times), compare_doubles);
+  qsort(steps, offscreen_frames, sizeof(*steps), compare_doubles);
+  printf("%d frames drawn offscreen: p50 %.3f ms, p95 %.3f ms, "
+         "p99 %.3f ms\n", offscreen_frames,
+         percentile(times, offscreen_frames, 0.50),
+         percentile(times, offscreen_frames, 0.95),
+         percentile(times, offscreen_frames, 0.99));
+  if(summary_file)
+    write_summary(steps, times);
+  if(golden_dir &&
+     !compare_frame_times(percentile(times, offscreen_frames, 0.50)))
+    failed = 1;
+  free(times);
+  exit(failed);
+}
+
+/* Add a line to summary_file for the run: the tunables and the rest of
+ * the setup, the percentiles of the sorted times for whole frames and for
+ * drawing alone, and the memory taken.  A new file starts with a line
+ * naming the fields. */
+void write_summary(double const *frames, double const *drawing) {
+  double const p[] = {0.50, 0.95, 0.99};
+  struct rusage usage;
+  FILE *file;
+  int i;
+
+  file = fopen(summary_file, "a");
+  if(!file) {
+    fprintf(stderr, "WARNING: unable to write %s\n", summary_file);
+    return;
+  }
+  fseek(file, 0, SEEK_END);
+  if(ftell(file) == 0) {
+    config_write_csv(file, 1);
+    fprintf(file, ",threads,sph,forest,frames,frame_p50_ms,frame_p95_ms,"
+            "frame_p99_ms,draw_p50_ms,draw_p95_ms,draw_p99_ms,"
+            "peak_particles,max_rss_kib\n");
   }
+  getrusage(RUSAGE_SELF, &usage);
+  config_write_csv(file, 0);
+  fprintf(file, ",%d,%d,%d,%d", pool_threads, water_interact, forest_trees,
+          offscreen_frames);
+  for(i = 0; i < 3; i++)
+    fprintf(file, ",%.3f", percentile(frames, offscreen_frames, p[i]));
+  for(i = 0; i < 3; i++)
+    fprintf(file, ",%.3f", percentile(drawing, offscreen_frames, p[i]));
+  /* ru_maxrss is in KiB */
+  fprintf(file, ",%d,%ld\n", water.peak, usage.ru_maxrss);
+  fclose(file);
+}
+
+/* The path: the door opens a notch every half second, as timef() opens
+ * it, while the viewer goes once round the apparatus, bobbing up and
+ * down */
+void script_frame(int frame) {
+  double const t = frame * offscreen_steps * sim_step;
+  double const turn = 2 * PI * frame / offscreen_frames;
+
+  doory = 0.05 * (1 + (int) (t / 0.5));
+  if(doory > 0.5) doory = 0.5;
+  viewer_y_angle = -1.0 + turn;
+  viewer_x_angle = -0.5 + 0.25 * sin(turn);
+  simulate(offscreen_steps);
+}
+
+/* Compare the median frame time with the golden run's.  Returns 0 when it
+ * is too slow. */
+int compare_frame_times(double median) {
+  char name[path_length];
+  double *times = NULL, ms, golden;
+  int count = 0, capacity = 0, frame;
+  FILE *file;
+
+  snprintf(name, sizeof(name), "%s/frame-times.csv", golden_dir);
+  file = fopen(name, "r");
+  if(!file) {
+    printf("no golden frame times in %s\n", name);
+    return 0;
+  }
+  fscanf(file, "%*[^\n]");
+  while(fscanf(file, "%d,%lf", &frame, &ms) == 2) {
+    if(count == capacity) {
+      capacity = capacity ? 2 * capacity : 256;
+      times = (double *) realloc(times, capacity * sizeof(double));
+      if(!times) {
+        fprintf(stderr, "ERROR: unable to allocate the frame times\n");
+        exit(1);
+      }
+    }
+    times[count++] = ms;
+  }
+  fclose(file);
+  if(count == 0) {
+    printf("no golden frame times in %s\n", name);
+    return 0;
+  }
+
+  qsort(times, count, sizeof(*times), compare_doubles);
+  golden = times[(int) (0.5 * (count - 1) + 0.5)];
+  free(times);
+  printf("p50 %.3f ms against %.3f ms for the golden run\n", median, golden);
+  if(median > golden_slowdown * golden) {
+    printf("frames are more than %.0f%% slower\n",
+           (golden_slowdown - 1.0) * 100);
+    return 0;
+  }
+  return 1;
+}
+
+/* The profile of the whole run */
+void at_exit() {
+  profile_report(stdout);
+  water_report(stdout);
+  if(profile_file)
+    profile_dump(profile_file);
 }
 
 #define BUFSIZE 512
@@ -773,6 +1281,7 @@ void mouse(int button, int state, int x, int y) {
   GLint viewport[4];
 
   if(button != GLUT_LEFT_BUTTON || state != GLUT_DOWN) return;
+  wake();
 
   glGetIntegerv(GL_VIEWPORT, viewport);
 
@@ -799,216 +1308,24 @@ void mouse(int button, int state, int x, int y) {
   return;
 }
 
-GLfloat *cross_product(GLfloat m1[3], GLfloat m2[3], GLfloat result[3]) {
-  result[0] = m1[1]*m2[2] - m2[1]*m1[2];
-  result[1] = m2[0]*m1[2] - m1[0]*m2[2];
-  result[2] = m1[0]*m2[1] - m2[0]*m1[1];
-  return result;
-}
-
-void normalise(GLfloat v[3]) {
-  GLfloat length;
-
-  length = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
-  v[0] = v[0]/length;
-  v[1] = v[1]/length;
-  v[2] = v[2]/length;
-  return;
+/* Value of a simulated quantity at the display time, between its value
+ * before and after the last simulation step */
+GLfloat interpolate(GLfloat previous, GLfloat current) {
+  return previous + (current - previous) * render_alpha;
 }
 
-GLfloat *difference(GLfloat m1[3], GLfloat m2[3], GLfloat result[3]) {
-  result[0] = m1[0] - m2[0];
-  result[1] = m1[1] - m2[1];
-  result[2] = m1[2] - m2[2];
-  return result;
-}
-
-float gettime(){
-  static clock_t t_old=0;
-  clock_t t_new, elapsed;
-
-  t_new=clock();
-
-  elapsed=t_new-t_old;
-
-  t_old = t_new;
-
-  return (float) elapsed/(float) CLOCKS_PER_SEC;
-}
-
-float randf() {
-  return (float)rand()/(float)RAND_MAX;
-}
-
-void new_particle(GLfloat particle[6]) {
-  GLfloat h, l, mag_hl;
-  GLfloat velocity;
-  GLfloat wh;
-  GLfloat dia;
-
-  /* drop of chute */
-  h = door_frame[0][1] - 2.0;
-  /* horizontal length of chute */
-  l = chute_length;
-  /* length of chute */
-  mag_hl = sqrt(h*h + l*l);
-  /* distance from bottom of door frame to top of water in container */
-  wh =  container_water_level-door_frame[0][1];
-  /* diameter of particles */
-  dia = water_particle_size/25.0;
-
-  /* position */
-  particle[0] = door_frame[0][0] + dia/2 + 
-                randf()*(door_frame[1][0] - door_frame[0][0] - dia);
-  particle[1] = door_frame[0][1] + dia + 
-                randf()*( ((wh > 0.5) ? doory : wh) - dia);
-  particle[2] = door_frame[0][2];
-
-  /* velocity */
-  velocity = (water_start_velocity + randf()*water_start_velocity)*wh;
-  particle[3] = 0.0;
-  particle[4] = -velocity*h/mag_hl;
-  particle[5] = +velocity*l/mag_hl;
-
-  /* activate particle */
-  particle[6] = 1;
-
-  /* decrease water level in container */
-  container_water_level -= water_particle_volume;
-
-  return;
-}
-
-void calculate_water(void) {
-  register int i;
-  float elapsed;
-  GLfloat end_of_chute, y_acceleration;
-  GLfloat acc, vert_acc, horiz_acc;
-  GLfloat h, l, mag_hl;
-  GLfloat wh, max_release;
-  GLfloat dia;
-  int released = 0;
-  register int used = 0;
-
-  /* compute values once */
-  elapsed = gettime();
-  end_of_chute = chute_length+door_frame[0][2];
-  y_acceleration = gravity * elapsed;
-  /* chute drop */
-  h = door_frame[0][1] - 2.0;
-  /* horizontal chute length */
-  l = chute_length;
-  /* chute length */
-  mag_hl = sqrt(h*h + l*l);
-  acc = gravity*h*cos(atan(l/h));
-  vert_acc = elapsed*acc*h/mag_hl;
-  horiz_acc = elapsed*acc*l/mag_hl;
-  /* water height above bottom of door frame */
-  wh =  container_water_level-door_frame[0][1];
-  /* number of particles to release this time */
-  max_release = elapsed * water_released/0.5 * ((wh > 0.5) ? doory : wh);
-  /* particle diameter */
-  dia = water_particle_size/25.0;
-
-  for(i = 0; i < water_particles; i++) {
-    if(water[i][6]) {  /* water particle is active */
-      if(water[i][2] > end_of_chute) {
-        /* fallen off the chute */
-        /* gravity */
-        water[i][4] -= y_acceleration;
-        /* position */
-        water[i][1] += water[i][4] * elapsed;
-        water[i][2] += water[i][5] * elapsed;
-        if(water[i][1] <= dia) {
-          /* increase water level in tray */
-          tray_water_level += tray_water_particle_volume;
-          if(container_water_level > door_frame[0][1] && 
-             released < max_release) {
-            /* restart particle */
-            new_particle(water[i]);
-            released++;
-          } else
-            /* deactivate particle */
-            water[i][6] = 0;
-        }
-      } else {
-        /* on the chute */
-        water[i][2] += water[i][5] * elapsed;
-        water[i][1] += water[i][4] * elapsed;
-        water[i][5] += horiz_acc;
-        water[i][4] -= vert_acc;
-      }
-      used++;
-    } else {
-      if(container_water_level > door_frame[0][1] && 
-         released < max_release) {
-        /* release more water */
-        new_particle(water[i]);
-        released++;
-      }
-    }
-  }
-  if(used == water_particles)
-    fprintf(stderr, "WARNING: Maximum number of particle reached\n");
-  active_particles = used;
-  return;
-}
-
-void leaf()
-{
-  /* draw a leaf */
-  glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, leaf_color);
-  glBegin(GL_TRIANGLES);
-    glVertex3f(0.0, 0.2, 0.0);
-    glVertex3f(0.2, 0.0, 0.0);
-    glVertex3f(-0.2, 0.0, 0.0);
-  glEnd();
-}
-
-void branch(float size, float branch_trigger)
-{
-  float const branch_length = 0.5 * size;
-
-  /* draw a branch */
-  glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, tree_color);
-  glBegin(GL_LINES);
-    glVertex3f(0.0, 0.0, 0.0);
-    glVertex3f(0.0, branch_length, 0.0);
-  glEnd();
-  glTranslatef(0.0, branch_length, 0.0);
-
-  if(size < branch_trigger) {
-    leaf();
-  } else {
-    /* draw more branches */
-    float const smaller_size = size - branch_length;
-    float const smaller_branch_trigger = branch_trigger * 0.75;
-    glPushMatrix();
-      glRotatef(0.0, 0.0, 1.0, 0.0);
-      glRotatef(25.0, 0.0, 0.0, 1.0);
-      branch(smaller_size * 0.9, smaller_branch_trigger * 0.9);
-    glPopMatrix();
-    glPushMatrix();
-      glRotatef(72.0, 0.0, 1.0, 0.0);
-      glRotatef(30.0, 0.0, 0.0, 1.0);
-      branch(smaller_size, smaller_branch_trigger * 0.9);
-    glPopMatrix();
-    glPushMatrix();
-      glRotatef(144.0, 0.0, 1.0, 0.0);
-      glRotatef(25.0, 0.0, 0.0, 1.0);
-      branch(smaller_size * 0.9, smaller_branch_trigger);
-    glPopMatrix();
-    glPushMatrix();
-      glRotatef(216.0, 0.0, 1.0, 0.0);
-      glRotatef(30.0, 0.0, 0.0, 1.0);
-      branch(smaller_size * 1.1, smaller_branch_trigger * 1.1);
-    glPopMatrix();
-    glPushMatrix();
-      glRotatef(288.0, 0.0, 1.0, 0.0);
-      glRotatef(35.0, 0.0, 0.0, 1.0);
-      branch(smaller_size, smaller_branch_trigger * 1.1);
-    glPopMatrix();
-  }
+/* A material for the scene: lit in a colour, or a texture when colour is
+ * NULL */
+struct scene_material material(GLfloat const *colour, GLfloat shininess,
+                               GLuint texture) {
+  struct scene_material m;
+
+  memset(&m, 0, sizeof(m));
+  if(colour)
+    memcpy(m.colour, colour, sizeof(m.colour));
+  m.shininess = shininess;
+  m.texture = texture;
+  return m;
 }
 
 void tree()
@@ -1017,7 +1334,9 @@ void tree()
     /* Place the tree in the center of the tray */
     glTranslatef(0.0, 0.0, door_frame[0][2] + (chute_length) + tray_size/2);
 
-    branch(tray_water_level * 10.0, 2.0);
+    tree_grow(&tray_tree,
+              interpolate(prev_tray_water_level, tray_water_level) * 10.0);
+    tree_draw_lod(&tray_tree);
   glPopMatrix();
 }
 
@@ -0,0 +1,17 @@
+#ifndef threedtree_h
+#define threedtree_h
+
+/* Dimensions of the scene, shared by the drawing code and the simulation */
+
+/* in case math.h dose not define PI */
+#ifndef PI
+#define PI 3.141593
+#endif
+
+#define container_radius        5.0
+#define container_height        10.0
+#define door_height             2.5     /* height of door above ground */
+#define chute_length            10.0    /* horizontal length of chute */
+#define tray_size               8.0     /* length of the sides of the tray */
+
+#endif /* threedtree_h */
@@ -0,0 +1,26 @@
+/* vi:set sw=2 ts=2 et: */
+
+/* mmap() flags and madvise() are beyond POSIX */
+#define _DEFAULT_SOURCE
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "arena.h"
+
+void *arena_reserve(size_t size) {
+  /* the pages are only found a home when first written */
+  void * const p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  return (p == MAP_FAILED) ? NULL : p;
+}
+
+void arena_release(void *p, size_t size) {
+  uintptr_t const page = (uintptr_t) sysconf(_SC_PAGESIZE);
+  uintptr_t const first = ((uintptr_t) p + page - 1) & ~(page - 1);
+  uintptr_t const last = ((uintptr_t) p + size) & ~(page - 1);
+
+  if(last > first)
+    madvise((void *) first, last - first, MADV_DONTNEED);
+}
@@ -0,0 +1,17 @@
+#ifndef arena_h
+#define arena_h
+
+#include <stddef.h>
+
+/* Address space set aside up front, which only takes memory for the pages
+ * that are touched.  A store can be laid out for the most it may ever hold,
+ * in one piece, and hand the pages above what it holds now back to the
+ * system with arena_release(); they read as zero if touched again.
+ * arena_reserve() returns NULL when the space cannot be had, and what it
+ * returns is aligned to a page. */
+
+void *arena_reserve(size_t);
+/* Only the whole pages inside the range are released */
+void arena_release(void *, size_t);
+
+#endif /* arena_h */
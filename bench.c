@@ -0,0 +1,438 @@
+/* vi:set sw=2 ts=2 et: */
+
+/* Headless micro benchmarks for the simulation, geometry and PNG hot paths.
+ *
+ * No window or GL context is created, so for the geometry only the CPU side
+ * of building it is measured.
+ *
+ * Every case is timed bench_repetitions times and reported as the mean time
+ * per operation, the throughput in items per second and the spread of the
+ * samples as a percentage of the mean. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <png.h>
+#include "3dtree.h"
+#include "water.h"
+#include "water_kernel.h"
+#include "sph.h"
+#include "pool.h"
+#include "timer.h"
+#include "soil.h"
+#include "tree.h"
+#include "forest.h"
+#include "read_png.h"
+#include "textures.h"
+#include "rng.h"
+
+#define bench_repetitions       15      /* samples per case */
+#define bench_min_sample        0.01    /* shortest sample in seconds */
+#define bench_water_steps       50      /* steps per calculate_water sample */
+#define bench_sph_steps         5       /* and with interacting particles */
+#define bench_tree_frames       600     /* frames a tree grows over */
+#define bench_max_particles     1000000
+/* room for the particles released while calculate_water is timed */
+#define bench_capacity          (bench_max_particles + bench_max_particles/8)
+
+static int const particle_counts[] = {1000, 10000, 100000, 1000000};
+static int const sph_counts[] = {1000, 10000, 100000, 200000};
+static int const soil_depths[] = {5, 8, 10};
+static float const tree_sizes[] = {5.0, 10.0, 20.0, 40.0};
+static int const image_sizes[] = {512, 1024, 2048};
+static int const forest_sizes[] = {100, 1000, 10000};
+
+static int repetitions = bench_repetitions;
+static struct particles saved;    /* starting state for calculate_water */
+static GLfloat saved_container_water_level;
+
+/* Print one result line from the per-operation sample times */
+static void report(char const *name, char const *param, double *samples,
+                   double items_per_op) {
+  double mean = 0.0, variance = 0.0;
+  int i;
+
+  for(i = 0; i < repetitions; i++)
+    mean += samples[i];
+  mean /= repetitions;
+  for(i = 0; i < repetitions; i++)
+    variance += (samples[i] - mean) * (samples[i] - mean);
+  variance /= (repetitions > 1) ? repetitions - 1 : 1;
+
+  printf("%-18s %-10s %14.1f %14.0f %7.1f%%\n", name, param, mean * 1e9,
+         items_per_op / mean, 100.0 * sqrt(variance) / mean);
+}
+
+/* Number of calls of fn that take at least bench_min_sample seconds */
+static int calibrate(void (*fn)(void *), void *arg) {
+  double start, elapsed;
+  int calls = 1;
+
+  for(;;) {
+    int i;
+
+    start = timer_now();
+    for(i = 0; i < calls; i++)
+      fn(arg);
+    elapsed = timer_now() - start;
+    if(elapsed >= bench_min_sample || calls >= (1 << 20))
+      return calls;
+    calls *= (elapsed > 0.0 && bench_min_sample / elapsed < 16.0) ?
+             (int) (bench_min_sample / elapsed) + 1 : 16;
+  }
+}
+
+/* Time fn(arg) and report the time per call */
+static void run(char const *name, char const *param, void (*fn)(void *),
+                void *arg, double items_per_op) {
+  double *samples = (double *) malloc(repetitions * sizeof(double));
+  int const calls = calibrate(fn, arg);
+  int r, i;
+
+  for(r = 0; r < repetitions; r++) {
+    double const start = timer_now();
+    for(i = 0; i < calls; i++)
+      fn(arg);
+    samples[r] = (timer_now() - start) / calls;
+  }
+  report(name, param, samples, items_per_op);
+  free(samples);
+}
+
+/* Fill the store with n particles spread out along their paths, the way a
+ * running flow would be */
+static void fill_water(int n) {
+  GLfloat const wh = container_water_level - door_frame[0][1];
+  struct rng r;
+  GLfloat age;
+  int i;
+
+  rng_seed(&r, 1);
+  emit_particles(&water, 0, n, wh, &r);
+  water.count = n;
+  for(i = 0; i < n; i++) {
+    age = 0.6 * rng_float(&r);
+    water.y[i] += water.vy[i] * age;
+    water.z[i] += water.vz[i] * age;
+  }
+}
+
+static void copy_particles(struct particles *dst, struct particles const *src) {
+  size_t const size = src->count * sizeof(GLfloat);
+
+  memcpy(dst->x, src->x, size);
+  memcpy(dst->y, src->y, size);
+  memcpy(dst->z, src->z, size);
+  memcpy(dst->vx, src->vx, size);
+  memcpy(dst->vy, src->vy, size);
+  memcpy(dst->vz, src->vz, size);
+  dst->count = src->count;
+}
+
+static void bench_calculate_water(int n, int steps) {
+  double *samples = (double *) malloc(repetitions * sizeof(double));
+  char param[32];
+  int r, i;
+
+  fill_water(n);
+  copy_particles(&saved, &water);
+  saved_container_water_level = container_water_level;
+
+  for(r = 0; r < repetitions; r++) {
+    double start;
+
+    /* every sample starts from the same state */
+    copy_particles(&water, &saved);
+    container_water_level = saved_container_water_level;
+    start = timer_now();
+    for(i = 0; i < steps; i++)
+      calculate_water(sim_step);
+    samples[r] = (timer_now() - start) / steps;
+  }
+  sprintf(param, water_interact ? "sph=%d" : "%d", n);
+  report("calculate_water", param, samples, n);
+  free(samples);
+}
+
+static void emit_batch(void *arg) {
+  int const n = *(int *) arg;
+  GLfloat const wh = container_water_level - door_frame[0][1];
+  struct rng r;
+
+  rng_seed(&r, 1);
+  emit_particles(&water, 0, n, wh, &r);
+}
+
+static void build_soil(void *arg) {
+  int const depth = *(int *) arg;
+  struct soil_mesh mesh;
+
+  soil_build(&mesh, tray_size, 1.0, depth, 1);
+  soil_free(&mesh);
+}
+
+static void build_tree(void *arg) {
+  struct tree t;
+
+  tree_init(&t, 2.0);
+  tree_grow(&t, *(float *) arg);
+  tree_free(&t);
+}
+
+/* Grow a kept tree to size a little each frame, as the tray fills */
+static void bench_tree_growth(float size) {
+  double *samples = (double *) malloc(repetitions * sizeof(double));
+  char param[32];
+  struct tree t;
+  int r, i;
+
+  for(r = 0; r < repetitions; r++) {
+    double start;
+
+    tree_init(&t, 2.0);
+    start = timer_now();
+    for(i = 1; i <= bench_tree_frames; i++)
+      tree_grow(&t, size * i / bench_tree_frames);
+    samples[r] = (timer_now() - start) / bench_tree_frames;
+    tree_free(&t);
+  }
+  sprintf(param, "size=%g", size);
+  report("tree_grow/frame", param, samples, 1);
+  free(samples);
+}
+
+/* Pick the level of detail for a grown tree seen from viewer_distance, as
+ * in the window */
+#define bench_viewer_distance   30.0
+#define bench_view_width        800
+#define bench_view_height       600
+#define bench_near              2.0
+#define bench_far               400.0
+
+static void select_lod(void *arg) {
+  struct tree * const t = (struct tree *) arg;
+  GLfloat modelview[16] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,
+                           0, 0, -bench_viewer_distance, 1};
+  GLfloat projection[16] = {0};
+  GLfloat const f = 1.0 / tan(45.0/2 * PI/180);
+
+  /* as gluPerspective(45, width/height, near, far) */
+  modelview[13] = -0.5 * t->size;
+  projection[0] = f * bench_view_height / bench_view_width;
+  projection[5] = f;
+  projection[10] = (bench_far + bench_near) / (bench_near - bench_far);
+  projection[11] = -1;
+  projection[14] = 2 * bench_far * bench_near / (bench_near - bench_far);
+  tree_select_lod(t, modelview, projection, bench_view_height);
+}
+
+static void grow_forest(void *arg) {
+  init_forest(*(int *) arg, 1);
+  forest_free();
+}
+
+struct image {
+  char *file_name;
+  unsigned int pixels;
+  GLubyte *buffer;        /* room for the pixels as RGBA */
+};
+
+static void load_image(void *arg) {
+  struct image const *image = (struct image const *) arg;
+  unsigned int width, height;
+  GLbyte *data;
+
+  read_png(image->file_name, &width, &height, &data);
+  free(data);
+}
+
+/* Decode into the same buffer every time, so that only decoding is timed */
+static void decode_image(void *arg) {
+  struct image const *image = (struct image const *) arg;
+  struct png_decoder decoder;
+
+  if(png_decoder_open(&decoder, image->file_name) != 0 ||
+     png_decoder_read(&decoder, image->buffer, 4 * decoder.width,
+                      png_target_rgba) != 0) {
+    fprintf(stderr, "ERROR: %s\n", decoder.error);
+    exit(1);
+  }
+  png_decoder_close(&decoder);
+}
+
+/* Write a size x size RGB test image with some texture to it */
+static void write_test_image(char const *file_name, int size) {
+  png_bytep row = (png_bytep) malloc(size * 3);
+  png_structp png_ptr;
+  png_infop info_ptr;
+  FILE *file;
+  int x, y;
+
+  file = fopen(file_name, "wb");
+  if(!file) {
+    perror(file_name);
+    exit(1);
+  }
+  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  info_ptr = png_create_info_struct(png_ptr);
+  png_init_io(png_ptr, file);
+  png_set_IHDR(png_ptr, info_ptr, size, size, 8, PNG_COLOR_TYPE_RGB,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(png_ptr, info_ptr);
+  for(y = 0; y < size; y++) {
+    for(x = 0; x < size; x++) {
+      row[3*x] = (png_byte) (x ^ y);
+      row[3*x+1] = (png_byte) (rand() & 0x3f);
+      row[3*x+2] = (png_byte) (y * 3);
+    }
+    png_write_row(png_ptr, row);
+  }
+  png_write_end(png_ptr, info_ptr);
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+  fclose(file);
+  free(row);
+}
+
+static void bench_read_png(char *file_name, char const *param) {
+  struct image image;
+  unsigned int width, height;
+  GLbyte *data;
+
+  read_png(file_name, &width, &height, &data);
+  free(data);
+  image.file_name = file_name;
+  image.pixels = width * height;
+  image.buffer = (GLubyte *) malloc(4 * image.pixels);
+  run("read_png", param, load_image, &image, image.pixels);
+  run("png_decode_rgba", param, decode_image, &image, image.pixels);
+  free(image.buffer);
+}
+
+static void cook_texture(void *arg) {
+  struct texture_image t;
+
+  texture_cook(&t, (char const *) arg, texture_size);
+  texture_release(&t);
+}
+
+static void load_texture(void *arg) {
+  struct texture_image t;
+
+  texture_load(&t, (char const *) arg, texture_size);
+  texture_release(&t);
+}
+
+int main(int argc, char *argv[]) {
+  char const *tmpdir = getenv("TMPDIR");
+  char param[32], file_name[256];
+  int threads = 1;
+  unsigned int i;
+
+  for(i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-reps") == 0 && i + 1 < argc) {
+      repetitions = atoi(argv[++i]);
+      if(repetitions < 1) repetitions = 1;
+    } else {
+      fprintf(stderr, "Usage: %s [-threads n] [-reps n]\n", argv[0]);
+      exit(1);
+    }
+  }
+  if(!tmpdir) tmpdir = "/tmp";
+
+  /* the same random numbers every run */
+  srand(1);
+
+  init_door_frame();
+  init_water(bench_capacity, threads, 1);
+  particles_init(&saved, bench_capacity);
+  doory = 0.5;
+
+  printf("water kernel %s, %d thread%s, %d samples per case\n",
+         water_kernel_name, pool_threads, (pool_threads == 1) ? "" : "s",
+         repetitions);
+  printf("%-18s %-10s %14s %14s %8s\n",
+         "case", "param", "ns/op", "items/s", "stddev");
+
+  /* op: one simulation step, items: particles */
+  for(i = 0; i < sizeof(particle_counts)/sizeof(*particle_counts); i++)
+    bench_calculate_water(particle_counts[i], bench_water_steps);
+
+  /* op: one step with the particles interacting, items: particles */
+  water_interact = 1;
+  init_sph(bench_capacity);
+  for(i = 0; i < sizeof(sph_counts)/sizeof(*sph_counts); i++)
+    bench_calculate_water(sph_counts[i], bench_sph_steps);
+  water_interact = 0;
+
+  /* op: emitting the batch, items: particles */
+  for(i = 0; i < sizeof(particle_counts)/sizeof(*particle_counts); i++) {
+    sprintf(param, "%d", particle_counts[i]);
+    run("emit_particles", param, emit_batch, (void *) &particle_counts[i],
+        particle_counts[i]);
+  }
+
+  /* op: the whole soil mesh, items: triangles */
+  for(i = 0; i < sizeof(soil_depths)/sizeof(*soil_depths); i++) {
+    sprintf(param, "depth=%d", soil_depths[i]);
+    run("soil_build", param, build_soil, (void *) &soil_depths[i],
+        4 * pow(3, soil_depths[i]));
+  }
+
+  /* op: one whole tree, items: trees */
+  for(i = 0; i < sizeof(tree_sizes)/sizeof(*tree_sizes); i++) {
+    sprintf(param, "size=%g", tree_sizes[i]);
+    run("tree_grow", param, build_tree, (void *) &tree_sizes[i], 1);
+  }
+
+  /* op: one frame of a growing tree, items: frames */
+  for(i = 0; i < sizeof(tree_sizes)/sizeof(*tree_sizes); i++)
+    bench_tree_growth(tree_sizes[i]);
+
+  /* op: one frame's level of detail, items: nodes in the tree */
+  for(i = 0; i < sizeof(tree_sizes)/sizeof(*tree_sizes); i++) {
+    struct tree t;
+
+    tree_init(&t, 2.0);
+    tree_grow(&t, tree_sizes[i]);
+    sprintf(param, "size=%g", tree_sizes[i]);
+    run("tree_select_lod", param, select_lod, &t, t.node_count);
+    if(t.tubes.vertex_count + t.lines_lod.vertex_count
+       + t.leaves_lod.vertex_count == 0) {
+      fprintf(stderr, "ERROR: tree_select_lod picked nothing at %s\n", param);
+      exit(1);
+    }
+    tree_free(&t);
+  }
+
+  /* op: placing and growing a forest, items: trees */
+  for(i = 0; i < sizeof(forest_sizes)/sizeof(*forest_sizes); i++) {
+    sprintf(param, "%d", forest_sizes[i]);
+    run("init_forest", param, grow_forest, (void *) &forest_sizes[i],
+        forest_sizes[i]);
+  }
+
+  /* op: one image, items: pixels */
+  bench_read_png("wood.png", "wood.png");
+  bench_read_png("soil.png", "soil.png");
+  for(i = 0; i < sizeof(image_sizes)/sizeof(*image_sizes); i++) {
+    snprintf(file_name, sizeof(file_name), "%s/3dtree-bench-%d.png", tmpdir,
+             image_sizes[i]);
+    write_test_image(file_name, image_sizes[i]);
+    sprintf(param, "%dx%d", image_sizes[i], image_sizes[i]);
+    bench_read_png(file_name, param);
+    remove(file_name);
+  }
+
+  /* op: one texture, decoded, scaled and given its mip chain or mapped from
+   * the cache, items: texels of the top level */
+  run("texture_cook", "soil.png", cook_texture, "soil.png",
+      texture_size * texture_size);
+  run("texture_load", "soil.png", load_texture, "soil.png",
+      texture_size * texture_size);
+
+  return 0;
+}
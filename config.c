@@ -0,0 +1,114 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <GL/gl.h>
+#include "config.h"
+#include "water.h"
+#include "soil.h"
+
+#define config_line_length      256
+
+#define tunable_int             0
+#define tunable_float           1
+
+struct tunable {
+  char const *name;
+  int type;
+  void *value;            /* an int or a GLfloat */
+  double min, max;        /* values that make sense */
+};
+
+static struct tunable const tunables[] = {
+  {"water_particles", tunable_int, &water_particles, 1, 100000000},
+  {"water_released", tunable_float, &water_released, 0, 100000000},
+  {"water_particle_size", tunable_float, &water_particle_size, 0.1, 100},
+  {"gravity", tunable_float, &gravity, 0, 10000},
+  {"soil_subdivision_depth", tunable_int, &soil_subdivision_depth, 0, 12},
+};
+
+#define tunable_count   (int) (sizeof(tunables) / sizeof(*tunables))
+
+char const *config_set(char const *name, char const *value) {
+  struct tunable const *t;
+  char *end;
+  double v;
+  int i;
+
+  for(i = 0; i < tunable_count; i++)
+    if(strcmp(tunables[i].name, name) == 0) break;
+  if(i == tunable_count)
+    return "no such tunable";
+  t = &tunables[i];
+
+  v = (t->type == tunable_int) ? strtol(value, &end, 10)
+                               : strtod(value, &end);
+  if(end == value || *end != '\0')
+    return (t->type == tunable_int) ? "not a whole number" : "not a number";
+  if(v < t->min || v > t->max)
+    return "out of range";
+  if(t->type == tunable_int)
+    *(int *) t->value = (int) v;
+  else
+    *(GLfloat *) t->value = v;
+  return NULL;
+}
+
+/* Trim the white space from both ends of s */
+static char *trim(char *s) {
+  char *end = s + strlen(s);
+
+  while(isspace((unsigned char) *s)) s++;
+  while(end > s && isspace((unsigned char) end[-1])) end--;
+  *end = '\0';
+  return s;
+}
+
+void config_load(char const *file_name) {
+  char line[config_line_length];
+  char *name, *value, *mark;
+  char const *error;
+  int number = 0;
+  FILE *file = fopen(file_name, "r");
+
+  if(!file) {
+    fprintf(stderr, "ERROR: unable to open %s\n", file_name);
+    exit(1);
+  }
+  while(fgets(line, sizeof(line), file)) {
+    number++;
+    if((mark = strchr(line, '#')) != NULL) *mark = '\0';
+    name = trim(line);
+    if(*name == '\0') continue;
+    if((mark = strchr(name, '=')) == NULL) {
+      fprintf(stderr, "ERROR: %s:%d: expected name = value\n", file_name,
+              number);
+      exit(1);
+    }
+    *mark = '\0';
+    name = trim(name);
+    value = trim(mark + 1);
+    if((error = config_set(name, value)) != NULL) {
+      fprintf(stderr, "ERROR: %s:%d: %s = %s: %s\n", file_name, number,
+              name, value, error);
+      exit(1);
+    }
+  }
+  fclose(file);
+}
+
+void config_write_csv(FILE *f, int header) {
+  int i;
+
+  for(i = 0; i < tunable_count; i++) {
+    if(i > 0) fputc(',', f);
+    if(header)
+      fputs(tunables[i].name, f);
+    else if(tunables[i].type == tunable_int)
+      fprintf(f, "%d", *(int const *) tunables[i].value);
+    else
+      fprintf(f, "%g", *(GLfloat const *) tunables[i].value);
+  }
+}
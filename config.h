@@ -0,0 +1,18 @@
+#ifndef config_h
+#define config_h
+
+#include <stdio.h>
+
+/* The tunables that can be set when the program starts, rather than built
+ * in: water_particles, water_released, water_particle_size, gravity and
+ * soil_subdivision_depth.  A config file holds one "name = value" a line,
+ * with # starting a comment. */
+
+/* Returns NULL, or why the value was not taken */
+char const *config_set(char const *name, char const *value);
+/* Exits when the file cannot be read or holds what config_set() refuses */
+void config_load(char const *file_name);
+/* The names, or the values, of the tunables as comma separated fields */
+void config_write_csv(FILE *, int header);
+
+#endif /* config_h */
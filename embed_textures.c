@@ -0,0 +1,68 @@
+/* vi:set sw=2 ts=2 et: */
+
+/* Cook PNGs into a C file that links them into the program, so that it
+ * starts without reading any files:
+ *
+ *   embed_textures embedded_textures.c wood.png soil.png
+ *
+ * Each is cooked as texture_load() would, at texture_size with its whole
+ * mip chain, and listed in embedded_textures[] under the PNG's name. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "textures.h"
+
+static void write_failed(char const *file_name) {
+  fprintf(stderr, "ERROR: unable to write %s\n", file_name);
+  remove(file_name);
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  struct texture_image t;
+  unsigned int *sizes, *levels;   /* of each texture, for the table */
+  unsigned int level, s;
+  size_t bytes, j;
+  FILE *out;
+  int i;
+
+  if(argc < 3) {
+    fprintf(stderr, "Usage: %s output.c textures.png...\n", argv[0]);
+    exit(1);
+  }
+  sizes = (unsigned int *) malloc(2 * (argc - 2) * sizeof(unsigned int));
+  if(!sizes) {
+    fprintf(stderr, "ERROR: unable to allocate the texture table\n");
+    exit(1);
+  }
+  levels = sizes + (argc - 2);
+  out = fopen(argv[1], "w");
+  if(!out) write_failed(argv[1]);
+
+  fprintf(out, "/* Made by embed_textures, do not edit */\n\n"
+               "#include \"textures.h\"\n");
+  for(i = 2; i < argc; i++) {
+    texture_cook(&t, argv[i], texture_size);
+    sizes[i - 2] = t.size;
+    levels[i - 2] = t.levels;
+    for(level = 0, s = t.size, bytes = 0; level < t.levels; level++, s /= 2)
+      bytes += 3 * s * s;
+
+    fprintf(out, "\n/* %s */\nstatic GLubyte const texture_%d[%lu] = {",
+            argv[i], i - 2, (unsigned long) bytes);
+    for(j = 0; j < bytes; j++)
+      fprintf(out, "%s%u,", (j % 16 == 0) ? "\n  " : "", t.data[j]);
+    fprintf(out, "\n};\n");
+    texture_release(&t);
+  }
+
+  fprintf(out, "\nstruct embedded_texture const embedded_textures[] = {\n");
+  for(i = 2; i < argc; i++)
+    fprintf(out, "  {\"%s\", %u, %u, texture_%d},\n", argv[i], sizes[i - 2],
+            levels[i - 2], i - 2);
+  fprintf(out, "};\nint const embedded_texture_count = %d;\n", argc - 2);
+
+  if(ferror(out) || fclose(out) != 0) write_failed(argv[1]);
+  free(sizes);
+  return 0;
+}
@@ -0,0 +1,355 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "3dtree.h"
+#include "water.h"
+#include "forest.h"
+#include "tree.h"
+#include "pool.h"
+#include "rng.h"
+#include "glcaps.h"
+#include "frustum.h"
+
+#define forest_classes  \
+  ((int) ((forest_max_size - forest_min_size) / forest_size_step) + 1)
+#define forest_clearing 6.0     /* space kept around the container and tray */
+#define forest_leaf_margin 0.5  /* more than a leaf sticks out of the bounds */
+/* generic attribute for the instance data, one that no fixed function
+ * attribute is aliased to */
+#define instance_attrib 7
+
+int forest_trees = 0;
+int forest_shapes = 0;
+GLfloat forest_centre[3];
+
+/* The trees of one shape.  Their instance data, x, z and the cosine and
+ * sine of the turn about y, are instances[first .. first+count), and
+ * those in view this frame visible[first .. first+shown). */
+struct forest_shape {
+  struct tree tree;
+  GLfloat size;
+  int first, count, shown;
+  GLfloat height, reach;  /* sphere about the trunk holding any turn */
+};
+
+static struct forest_shape *shapes;
+static GLfloat *placed;         /* instance data in tree order */
+static int *size_class;         /* shape class of each tree */
+static GLfloat *instances;      /* instance data grouped by shape */
+static GLfloat *visible;        /* the instances in view */
+static unsigned long forest_seed;
+static int workers;             /* threads placing trees or growing shapes */
+
+static int gl_ready = 0;
+static GLuint instance_buffer;
+static GLuint program;          /* 0 to draw each tree on its own */
+static GLint scale_uniform;
+
+static char const * const vertex_shader =
+  "#version 120\n"
+  "attribute vec4 instance;\n"
+  "uniform float scale;\n"
+  "varying vec4 color;\n"
+  "void main() {\n"
+  "  mat3 turn = mat3(instance.z, 0.0, -instance.w,\n"
+  "                   0.0, 1.0, 0.0,\n"
+  "                   instance.w, 0.0, instance.z);\n"
+  "  vec3 p = turn * (gl_Vertex.xyz * scale);\n"
+  "  vec4 eye = gl_ModelViewMatrix *\n"
+  "             vec4(p.x + instance.x, p.y, p.z + instance.y, 1.0);\n"
+  "  vec3 n = normalize(gl_NormalMatrix * (turn * gl_Normal));\n"
+  "  vec3 l = normalize(gl_LightSource[0].position.xyz -\n"
+  "                     eye.xyz * gl_LightSource[0].position.w);\n"
+  /* ambient and diffuse lighting, as the fixed function does it */
+  "  color = gl_FrontLightModelProduct.sceneColor +\n"
+  "          gl_FrontLightProduct[0].ambient +\n"
+  "          gl_FrontLightProduct[0].diffuse * max(dot(n, l), 0.0);\n"
+  "  color.a = gl_FrontMaterial.diffuse.a;\n"
+  "  gl_Position = gl_ProjectionMatrix * eye;\n"
+  "}\n";
+
+static char const * const fragment_shader =
+  "#version 120\n"
+  "varying vec4 color;\n"
+  "void main() {\n"
+  "  gl_FragColor = color;\n"
+  "}\n";
+
+static void *alloc(size_t size) {
+  void * const p = malloc(size);
+  if(!p) {
+    fprintf(stderr, "ERROR: unable to allocate the forest\n");
+    exit(1);
+  }
+  return p;
+}
+
+/* True where a tree would be in the way of the container, chute or tray */
+static int in_clearing(GLfloat x, GLfloat z) {
+  return x > -container_radius - forest_clearing &&
+         x < container_radius + forest_clearing &&
+         z > -container_radius - forest_clearing &&
+         z < forest_centre[2] + tray_size/2 + forest_clearing;
+}
+
+/* Place a worker's share of the trees.  Every tree has its own seed, so the
+ * forest does not depend on the number of threads. */
+static void place_trees(void *arg, int w) {
+  int const first = (int) ((long) forest_trees * w / workers);
+  int const last = (int) ((long) forest_trees * (w + 1) / workers);
+  struct rng r;
+  GLfloat x, z, turn;
+  int i;
+
+  for(i = first; i < last; i++) {
+    rng_seed(&r, forest_seed ^ ((uint64_t) (i + 1) << 32));
+    do {
+      x = (2.0 * rng_float(&r) - 1.0) * forest_radius;
+      z = (2.0 * rng_float(&r) - 1.0) * forest_radius;
+    } while(x*x + z*z > forest_radius * forest_radius ||
+            in_clearing(forest_centre[0] + x, forest_centre[2] + z));
+    size_class[i] = (int) (rng_float(&r) * forest_classes);
+    turn = 2.0 * PI * rng_float(&r);
+    placed[4*i] = forest_centre[0] + x;
+    placed[4*i+1] = forest_centre[2] + z;
+    placed[4*i+2] = cos(turn);
+    placed[4*i+3] = sin(turn);
+  }
+}
+
+/* Grow every workers'th shape, largest first, so the costly shapes are
+ * spread over the threads */
+static void grow_shapes(void *arg, int w) {
+  int s;
+
+  for(s = forest_shapes - 1 - w; s >= 0; s -= workers) {
+    struct tree_node const *trunk;
+
+    tree_init(&shapes[s].tree, 2.0);
+    tree_grow(&shapes[s].tree, shapes[s].size);
+    /* the trunk's bounds hold the whole tree; move their centre onto the
+     * trunk so that they hold it however it is turned */
+    trunk = &shapes[s].tree.nodes[0];
+    shapes[s].height = shapes[s].size * trunk->centre[1];
+    shapes[s].reach = shapes[s].size * (trunk->radius +
+      sqrt(trunk->centre[0]*trunk->centre[0] +
+           trunk->centre[2]*trunk->centre[2])) + forest_leaf_margin;
+  }
+}
+
+void init_forest(int trees, unsigned long seed) {
+  int shape_of_class[forest_classes], count[forest_classes];
+  int i, c, s, first = 0;
+
+  forest_trees = trees;
+  forest_seed = seed;
+  forest_centre[0] = 0.0;
+  forest_centre[1] = 0.0;
+  forest_centre[2] = door_frame[0][2] + chute_length + tray_size/2;
+
+  placed = (GLfloat *) alloc(4 * trees * sizeof(GLfloat));
+  instances = (GLfloat *) alloc(4 * trees * sizeof(GLfloat));
+  visible = (GLfloat *) alloc(4 * trees * sizeof(GLfloat));
+  size_class = (int *) alloc(trees * sizeof(int));
+
+  workers = (trees + 255) / 256;
+  if(workers > pool_threads) workers = pool_threads;
+  if(workers < 1) workers = 1;
+  pool_run(place_trees, NULL, workers);
+
+  /* one shape for every size class in use */
+  for(c = 0; c < forest_classes; c++)
+    count[c] = 0;
+  for(i = 0; i < trees; i++)
+    count[size_class[i]]++;
+  shapes = (struct forest_shape *)
+    alloc(forest_classes * sizeof(struct forest_shape));
+  forest_shapes = 0;
+  for(c = 0; c < forest_classes; c++) {
+    if(count[c] == 0) continue;
+    s = forest_shapes++;
+    shape_of_class[c] = s;
+    shapes[s].size = forest_min_size + c * forest_size_step;
+    shapes[s].first = first;
+    shapes[s].count = 0;
+    first += count[c];
+  }
+
+  /* group the instance data by shape */
+  for(i = 0; i < trees; i++) {
+    struct forest_shape * const shape =
+      &shapes[shape_of_class[size_class[i]]];
+    GLfloat * const instance =
+      &instances[4 * (shape->first + shape->count++)];
+    instance[0] = placed[4*i];
+    instance[1] = placed[4*i+1];
+    instance[2] = placed[4*i+2];
+    instance[3] = placed[4*i+3];
+  }
+  free(placed);
+  free(size_class);
+  placed = NULL;
+  size_class = NULL;
+
+  workers = (forest_shapes < pool_threads) ? forest_shapes : pool_threads;
+  if(workers > 0)
+    pool_run(grow_shapes, NULL, workers);
+}
+
+void forest_free() {
+  int s;
+
+  for(s = 0; s < forest_shapes; s++)
+    tree_free(&shapes[s].tree);
+  if(gl_ready && instance_buffer)
+    glDeleteBuffers(1, &instance_buffer);
+  if(gl_ready && program)
+    glDeleteProgram(program);
+  free(shapes);
+  free(instances);
+  free(visible);
+  shapes = NULL;
+  instances = NULL;
+  visible = NULL;
+  forest_trees = forest_shapes = 0;
+  gl_ready = 0;
+}
+
+static GLuint compile_shader(GLenum type, char const *source) {
+  GLuint const shader = glCreateShader(type);
+  GLint compiled;
+  char log[1024];
+
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if(!compiled) {
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    fprintf(stderr, "WARNING: forest shader: %s\n", log);
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+/* The instancing program, or 0 when the GL cannot draw instances */
+static GLuint instancing_program() {
+  GLuint vertex, fragment, p;
+  GLint linked;
+
+  if(!gl_version_at_least(3, 3) &&
+     !(gl_version_at_least(2, 0) &&
+       gl_has_extension("GL_ARB_instanced_arrays") &&
+       gl_has_extension("GL_ARB_draw_instanced")))
+    return 0;
+
+  vertex = compile_shader(GL_VERTEX_SHADER, vertex_shader);
+  fragment = compile_shader(GL_FRAGMENT_SHADER, fragment_shader);
+  if(!vertex || !fragment) {
+    if(vertex) glDeleteShader(vertex);
+    if(fragment) glDeleteShader(fragment);
+    return 0;
+  }
+  p = glCreateProgram();
+  glAttachShader(p, vertex);
+  glAttachShader(p, fragment);
+  glBindAttribLocation(p, instance_attrib, "instance");
+  glLinkProgram(p);
+  glDeleteShader(vertex);
+  glDeleteShader(fragment);
+  glGetProgramiv(p, GL_LINK_STATUS, &linked);
+  if(!linked) {
+    fprintf(stderr, "WARNING: unable to link the forest shaders\n");
+    glDeleteProgram(p);
+    return 0;
+  }
+  scale_uniform = glGetUniformLocation(p, "scale");
+  return p;
+}
+
+static void init_forest_gl() {
+  program = instancing_program();
+  if(program)
+    glGenBuffers(1, &instance_buffer);
+  gl_ready = 1;
+}
+
+/* Gather the trees in view into visible, still grouped by shape.  Returns
+ * how many there are. */
+static int cull_trees() {
+  struct frustum view;
+  GLfloat centre[3];
+  int s, i, shown = 0;
+
+  frustum_from_gl(&view);
+  for(s = 0; s < forest_shapes; s++) {
+    shapes[s].shown = 0;
+    centre[1] = shapes[s].height;
+    for(i = shapes[s].first; i < shapes[s].first + shapes[s].count; i++) {
+      centre[0] = instances[4*i];
+      centre[2] = instances[4*i+1];
+      if(!frustum_sphere(&view, centre, shapes[s].reach)) continue;
+      memcpy(&visible[4 * (shapes[s].first + shapes[s].shown++)],
+             &instances[4*i], 4 * sizeof(GLfloat));
+    }
+    shown += shapes[s].shown;
+  }
+  return shown;
+}
+
+/* Draw the branches or the leaves of every tree, with one material setup
+ * for the lot */
+static void draw_batch(int leaves) {
+  void (* const draw)(struct tree *, GLint, int) =
+    leaves ? tree_draw_leaves : tree_draw_branches;
+  int s, i;
+
+  glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE,
+               leaves ? leaf_color : tree_color);
+  for(s = 0; s < forest_shapes; s++) {
+    if(shapes[s].shown == 0) continue;
+    if(program) {
+      /* one draw for every tree of the shape in view */
+      glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+      glVertexAttribPointer(instance_attrib, 4, GL_FLOAT, GL_FALSE, 0,
+                            (GLfloat *) NULL + 4 * shapes[s].first);
+      draw(&shapes[s].tree, scale_uniform, shapes[s].shown);
+      continue;
+    }
+    for(i = shapes[s].first; i < shapes[s].first + shapes[s].shown; i++) {
+      GLfloat const * const instance = &visible[4*i];
+      glPushMatrix();
+        glTranslatef(instance[0], 0.0, instance[1]);
+        glRotatef(atan2(instance[3], instance[2]) * 180.0/PI, 0.0, 1.0, 0.0);
+        draw(&shapes[s].tree, -1, 0);
+      glPopMatrix();
+    }
+  }
+}
+
+void forest_draw() {
+  if(forest_trees == 0) return;
+  if(!gl_ready) init_forest_gl();
+  if(cull_trees() == 0) return;
+
+  if(program) {
+    /* the trees in view change with the camera, so send them each frame */
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, 4 * forest_trees * sizeof(GLfloat),
+                 visible, GL_STREAM_DRAW);
+    glUseProgram(program);
+    glEnableVertexAttribArray(instance_attrib);
+    glVertexAttribDivisor(instance_attrib, 1);
+  }
+  draw_batch(0);
+  draw_batch(1);
+  if(program) {
+    glVertexAttribDivisor(instance_attrib, 0);
+    glDisableVertexAttribArray(instance_attrib);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glUseProgram(0);
+  }
+}
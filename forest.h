@@ -0,0 +1,24 @@
+#ifndef forest_h
+#define forest_h
+
+#include <GL/gl.h>
+
+/* Forest mode: many trees grown by the rules in tree.c, scattered over
+ * the ground around the tray.  Trees with the same shape are only built
+ * once and drawn instanced when the GL allows. */
+
+#define forest_radius           60.0    /* trees grow this far from the tray */
+#define forest_min_size         4.0
+#define forest_max_size         12.0
+#define forest_size_step        0.5     /* trees this close share a shape */
+
+extern int forest_trees;                /* 0 when not in forest mode */
+extern int forest_shapes;               /* distinct shapes built */
+extern GLfloat forest_centre[3];
+
+/* Place and grow the trees on the pool's threads; needs no GL context */
+void init_forest(int trees, unsigned long seed);
+void forest_draw(void);
+void forest_free(void);
+
+#endif /* forest_h */
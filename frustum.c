@@ -0,0 +1,65 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <math.h>
+#include "frustum.h"
+
+/* The planes are sums and differences of the rows of projection times
+ * modelview (Gribb and Hartmann) */
+void frustum_from_matrices(struct frustum *f, GLfloat const modelview[16],
+                           GLfloat const projection[16]) {
+  GLfloat clip[16], length;
+  int row, col, i;
+
+  for(col = 0; col < 4; col++)
+    for(row = 0; row < 4; row++)
+      clip[4*col+row] = projection[row] * modelview[4*col] +
+                        projection[4+row] * modelview[4*col+1] +
+                        projection[8+row] * modelview[4*col+2] +
+                        projection[12+row] * modelview[4*col+3];
+
+  /* left, right, bottom, top, near and far */
+  for(i = 0; i < 6; i++) {
+    GLfloat const sign = (i & 1) ? -1.0 : 1.0;
+    for(col = 0; col < 4; col++)
+      f->planes[i][col] = clip[4*col+3] + sign * clip[4*col+i/2];
+    length = sqrt(f->planes[i][0]*f->planes[i][0] +
+                  f->planes[i][1]*f->planes[i][1] +
+                  f->planes[i][2]*f->planes[i][2]);
+    for(col = 0; col < 4; col++)
+      f->planes[i][col] /= length;
+  }
+}
+
+void frustum_from_gl(struct frustum *f) {
+  GLfloat modelview[16], projection[16];
+
+  glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+  glGetFloatv(GL_PROJECTION_MATRIX, projection);
+  frustum_from_matrices(f, modelview, projection);
+}
+
+int frustum_sphere(struct frustum const *f, GLfloat const centre[3],
+                   GLfloat radius) {
+  int i;
+
+  for(i = 0; i < 6; i++)
+    if(f->planes[i][0]*centre[0] + f->planes[i][1]*centre[1] +
+       f->planes[i][2]*centre[2] + f->planes[i][3] < -radius)
+      return 0;
+  return 1;
+}
+
+int frustum_box(struct frustum const *f, struct box const *b) {
+  GLfloat p[3];
+  int i, j;
+
+  for(i = 0; i < 6; i++) {
+    /* the corner furthest along the plane's normal */
+    for(j = 0; j < 3; j++)
+      p[j] = (f->planes[i][j] >= 0.0) ? b->max[j] : b->min[j];
+    if(f->planes[i][0]*p[0] + f->planes[i][1]*p[1] + f->planes[i][2]*p[2] +
+       f->planes[i][3] < 0.0)
+      return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,27 @@
+#ifndef frustum_h
+#define frustum_h
+
+#include <GL/gl.h>
+
+/* The view volume as six planes, ax + by + cz + d >= 0 inside, in the
+ * coordinates of the modelview matrix it was made from */
+struct frustum {
+  GLfloat planes[6][4];
+};
+
+/* Axis aligned bounding box */
+struct box {
+  GLfloat min[3], max[3];
+};
+
+void frustum_from_matrices(struct frustum *, GLfloat const modelview[16],
+                           GLfloat const projection[16]);
+/* From the current GL matrices */
+void frustum_from_gl(struct frustum *);
+
+/* Whether a sphere or box may be in view; 0 when it is certainly not */
+int frustum_sphere(struct frustum const *, GLfloat const centre[3],
+                   GLfloat radius);
+int frustum_box(struct frustum const *, struct box const *);
+
+#endif /* frustum_h */
@@ -0,0 +1,31 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <stdio.h>
+#include <string.h>
+#include <GL/gl.h>
+#include "glcaps.h"
+
+int gl_version_at_least(int major, int minor) {
+  char const * const version = (char const *) glGetString(GL_VERSION);
+  int have_major = 0, have_minor = 0;
+
+  if(!version || sscanf(version, "%d.%d", &have_major, &have_minor) != 2)
+    return 0;
+  return have_major > major || (have_major == major && have_minor >= minor);
+}
+
+int gl_has_extension(char const *name) {
+  char const * const extensions = (char const *) glGetString(GL_EXTENSIONS);
+  size_t const length = strlen(name);
+  char const *found = extensions;
+
+  if(!extensions) return 0;
+  /* match whole words only */
+  while((found = strstr(found, name)) != NULL) {
+    if((found == extensions || found[-1] == ' ') &&
+       (found[length] == ' ' || found[length] == '\0'))
+      return 1;
+    found += length;
+  }
+  return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef glcaps_h
+#define glcaps_h
+
+/* Queries of what the current GL context supports.  A context must be
+ * current. */
+int gl_version_at_least(int, int);
+int gl_has_extension(char const *);
+
+#endif /* glcaps_h */
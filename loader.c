@@ -0,0 +1,44 @@
+/* vi:set sw=2 ts=2 et: */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdio.h>
+#include "loader.h"
+
+struct loader_job {
+  void (*fn)(void *);
+  void *arg;
+};
+
+static pthread_t threads[loader_max_jobs];
+static struct loader_job jobs[loader_max_jobs];
+static int job_count = 0;
+
+static void *job_main(void *arg) {
+  struct loader_job const *job = (struct loader_job const *) arg;
+
+  job->fn(job->arg);
+  return NULL;
+}
+
+void loader_run(void (*fn)(void *), void *arg) {
+  /* without a thread to spare, do it now */
+  if(job_count == loader_max_jobs) {
+    fn(arg);
+    return;
+  }
+  jobs[job_count].fn = fn;
+  jobs[job_count].arg = arg;
+  if(pthread_create(&threads[job_count], NULL, job_main,
+                    &jobs[job_count]) != 0) {
+    fn(arg);
+    return;
+  }
+  job_count++;
+}
+
+void loader_wait() {
+  while(job_count > 0)
+    pthread_join(threads[--job_count], NULL);
+}
@@ -0,0 +1,15 @@
+#ifndef loader_h
+#define loader_h
+
+/* Asset loading off the GL thread.  loader_run() starts fn(arg) on a thread
+ * of its own at once, so that images are decoded and geometry is built
+ * while the window and GL state come up; loader_wait() returns once every
+ * job has finished.  The jobs must not touch the GL: uploading what they
+ * made is left to the GL thread after loader_wait(). */
+
+#define loader_max_jobs         8
+
+void loader_run(void (*)(void *), void *);
+void loader_wait(void);
+
+#endif /* loader_h */
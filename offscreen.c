@@ -0,0 +1,153 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "offscreen.h"
+#include "read_png.h"
+
+static int width, height;
+static GLubyte *pixels;         /* what was drawn, RGB from the bottom row */
+
+static void fail(char const *what) {
+  fprintf(stderr, "ERROR: unable to draw offscreen: %s\n", what);
+  exit(1);
+}
+
+/* Mesa's surfaceless platform needs no display at all; failing that, try
+ * whatever the default display is */
+static EGLDisplay get_display(void) {
+  PFNEGLGETPLATFORMDISPLAYEXTPROC const get_platform_display =
+    (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+    eglGetProcAddress("eglGetPlatformDisplayEXT");
+  EGLDisplay display = EGL_NO_DISPLAY;
+
+  if(get_platform_display)
+    display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                   EGL_DEFAULT_DISPLAY, NULL);
+  if(display == EGL_NO_DISPLAY)
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  return display;
+}
+
+void offscreen_init(int w, int h) {
+  /* the default is configs for windows, which there are none of */
+  EGLint const attributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                               EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                               EGL_NONE};
+  EGLDisplay const display = get_display();
+  EGLContext context;
+  EGLConfig config;
+  EGLint configs;
+  GLuint framebuffer, renderbuffers[2];
+
+  if(display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+    fail("no EGL display");
+  if(!eglBindAPI(EGL_OPENGL_API) ||
+     !eglChooseConfig(display, attributes, &config, 1, &configs) ||
+     configs < 1)
+    fail("no EGL config for OpenGL");
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+  if(context == EGL_NO_CONTEXT ||
+     !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    fail("no OpenGL context without a surface");
+
+  /* colour and depth, as the window would have */
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glGenRenderbuffers(2, renderbuffers);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, renderbuffers[0]);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, renderbuffers[1]);
+  if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    fail("incomplete framebuffer");
+
+  width = w;
+  height = h;
+  pixels = (GLubyte *) malloc(3 * width * height);
+  if(!pixels) fail("out of memory");
+}
+
+static void read_pixels(void) {
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+}
+
+void offscreen_save(char const *file_name) {
+  png_structp png;
+  png_infop info;
+  FILE *file;
+  int y;
+
+  read_pixels();
+  file = fopen(file_name, "wb");
+  if(!file) {
+    fprintf(stderr, "ERROR: unable to write %s\n", file_name);
+    exit(1);
+  }
+  png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  info = png ? png_create_info_struct(png) : NULL;
+  if(!info || setjmp(png_jmpbuf(png))) {
+    fprintf(stderr, "ERROR: unable to write %s\n", file_name);
+    exit(1);
+  }
+  png_init_io(png, file);
+  png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(png, info);
+  /* the GL's rows go up the picture */
+  for(y = height - 1; y >= 0; y--)
+    png_write_row(png, pixels + 3 * width * y);
+  png_write_end(png, info);
+  png_destroy_write_struct(&png, &info);
+  if(fclose(file) != 0) {
+    fprintf(stderr, "ERROR: unable to write %s\n", file_name);
+    exit(1);
+  }
+}
+
+long offscreen_compare(char const *file_name, int tolerance) {
+  struct png_decoder decoder;
+  GLubyte *expected;
+  long wrong = 0;
+  int x, y, c;
+
+  if(png_decoder_open(&decoder, file_name) != 0)
+    return -1;
+  if(decoder.width != width || decoder.height != height ||
+     !(expected = (GLubyte *) malloc(3 * width * height))) {
+    png_decoder_close(&decoder);
+    return -1;
+  }
+  if(png_decoder_read(&decoder, expected, 3 * width, png_target_rgb) != 0) {
+    png_decoder_close(&decoder);
+    free(expected);
+    return -1;
+  }
+  png_decoder_close(&decoder);
+
+  read_pixels();
+  for(y = 0; y < height; y++) {
+    GLubyte const * const drawn = pixels + 3 * width * (height - 1 - y);
+    GLubyte const * const row = expected + 3 * width * y;
+
+    for(x = 0; x < 3 * width; x += 3)
+      for(c = 0; c < 3; c++)
+        if(abs(drawn[x + c] - row[x + c]) > tolerance) {
+          wrong++;
+          break;
+        }
+  }
+  free(expected);
+  return wrong;
+}
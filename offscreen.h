@@ -0,0 +1,18 @@
+#ifndef offscreen_h
+#define offscreen_h
+
+/* Drawing without a window, for machines with no display: a surfaceless
+ * EGL context, rendering into a framebuffer object, which usually means
+ * Mesa's software rasteriser. */
+
+/* Make such a context current, drawing into width x height.  Exits when
+ * there is none to be had. */
+void offscreen_init(int width, int height);
+/* Write what has been drawn to a PNG.  Exits when it cannot. */
+void offscreen_save(char const *file_name);
+/* Compare what has been drawn with a PNG.  Returns the number of pixels with
+ * a channel more than tolerance out, or -1 when the PNG cannot be read or is
+ * another size. */
+long offscreen_compare(char const *file_name, int tolerance);
+
+#endif /* offscreen_h */
@@ -0,0 +1,84 @@
+/* vi:set sw=2 ts=2 et: */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "pool.h"
+
+int pool_threads = 1;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t turn = PTHREAD_MUTEX_INITIALIZER; /* one run at once */
+static int started = 0;
+static pthread_cond_t start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static unsigned long generation = 0;  /* bumped for every pool_run() */
+static int running = 0;               /* workers still busy */
+static int active = 0;                /* workers taking part in this run */
+static void (*job)(void *, int);
+static void *job_arg;
+
+static void *worker_main(void *arg) {
+  int const worker = (int) (long) arg;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&lock);
+  for(;;) {
+    while(generation == seen)
+      pthread_cond_wait(&start, &lock);
+    seen = generation;
+    if(worker < active) {
+      pthread_mutex_unlock(&lock);
+      job(job_arg, worker);
+      pthread_mutex_lock(&lock);
+      if(--running == 0)
+        pthread_cond_signal(&done);
+    }
+  }
+  return NULL;
+}
+
+void init_pool(int threads) {
+  pthread_t thread;
+  long i;
+
+  if(started) return;
+  started = 1;
+  if(threads < 1) threads = 1;
+  for(i = 1; i < threads; i++) {
+    if(pthread_create(&thread, NULL, worker_main, (void *) i) != 0) {
+      fprintf(stderr, "WARNING: only %ld worker threads available\n", i);
+      break;
+    }
+    pthread_detach(thread);
+  }
+  pool_threads = (int) i;
+}
+
+void pool_run(void (*fn)(void *, int), void *arg, int n) {
+  if(n > pool_threads) n = pool_threads;
+  if(n <= 1) {
+    fn(arg, 0);
+    return;
+  }
+
+  pthread_mutex_lock(&turn);
+  pthread_mutex_lock(&lock);
+  job = fn;
+  job_arg = arg;
+  active = n;
+  running = n - 1;
+  generation++;
+  pthread_cond_broadcast(&start);
+  pthread_mutex_unlock(&lock);
+
+  fn(arg, 0);
+
+  pthread_mutex_lock(&lock);
+  while(running > 0)
+    pthread_cond_wait(&done, &lock);
+  pthread_mutex_unlock(&lock);
+  pthread_mutex_unlock(&turn);
+}
@@ -0,0 +1,14 @@
+#ifndef pool_h
+#define pool_h
+
+/* Fork-join thread pool.  pool_run() calls fn(arg, worker) for worker
+ * 0 .. n-1, running worker 0 on the calling thread, and returns once all of
+ * them have finished.  Runs from several threads take turns.  init_pool()
+ * starts the workers the first time it is called and does nothing after. */
+
+extern int pool_threads;   /* number of workers, including the caller */
+
+void init_pool(int);
+void pool_run(void (*)(void *, int), void *, int);
+
+#endif /* pool_h */
@@ -0,0 +1,115 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+#ifndef NO_PROFILE
+
+/* The last profile_samples times of a phase in milliseconds, the newest at
+ * (count - 1) % profile_samples */
+struct ring {
+  float times[profile_samples];
+  unsigned long count;
+};
+
+struct phase_stats {
+  unsigned long count;
+  double mean, p50, p95, p99;
+};
+
+static char const * const phase_names[profile_phases] = {
+  "frame", "simulate", "apparatus", "door", "forest", "water_tray",
+  "water_chute", "water_tank", "tree", "swap"};
+
+static struct ring rings[profile_phases];
+double profile_starts[profile_phases];
+
+void profile_record(int phase, double start) {
+  struct ring * const r = &rings[phase];
+
+  /* the first frame has no frame before it */
+  if(start == 0.0) return;
+  r->times[r->count % profile_samples] = (timer_now() - start) * 1000.0;
+  r->count++;
+}
+
+static int compare_times(void const *a, void const *b) {
+  float const x = *(float const *) a, y = *(float const *) b;
+
+  return (x > y) - (x < y);
+}
+
+/* Sort a copy of the ring and take the nearest rank */
+static void phase_stats(int phase, struct phase_stats *s) {
+  struct ring const * const r = &rings[phase];
+  float sorted[profile_samples];
+  int const n = (r->count < profile_samples) ? r->count : profile_samples;
+  int i;
+
+  memset(s, 0, sizeof(*s));
+  s->count = r->count;
+  if(n == 0) return;
+  memcpy(sorted, r->times, n * sizeof(*sorted));
+  qsort(sorted, n, sizeof(*sorted), compare_times);
+  for(i = 0; i < n; i++)
+    s->mean += sorted[i];
+  s->mean /= n;
+  s->p50 = sorted[(int) (0.50 * (n - 1) + 0.5)];
+  s->p95 = sorted[(int) (0.95 * (n - 1) + 0.5)];
+  s->p99 = sorted[(int) (0.99 * (n - 1) + 0.5)];
+}
+
+void profile_report(FILE *file) {
+  struct phase_stats s;
+  int i;
+
+  fprintf(file, "%-12s %8s %9s %9s %9s %9s  (ms, last %d)\n", "phase",
+          "count", "mean", "p50", "p95", "p99", profile_samples);
+  for(i = 0; i < profile_phases; i++) {
+    phase_stats(i, &s);
+    if(s.count == 0) continue;
+    fprintf(file, "%-12s %8lu %9.3f %9.3f %9.3f %9.3f\n", phase_names[i],
+            s.count, s.mean, s.p50, s.p95, s.p99);
+  }
+}
+
+void profile_dump(char const *file_name) {
+  size_t const n = strlen(file_name);
+  int const json = n > 5 && strcmp(file_name + n - 5, ".json") == 0;
+  struct phase_stats s;
+  FILE *file;
+  int i;
+
+  file = fopen(file_name, "w");
+  if(!file) {
+    fprintf(stderr, "WARNING: unable to write the profile to %s\n",
+            file_name);
+    return;
+  }
+  fprintf(file, json ? "{\n" : "phase,count,mean_ms,p50_ms,p95_ms,p99_ms\n");
+  for(i = 0; i < profile_phases; i++) {
+    phase_stats(i, &s);
+    if(json)
+      fprintf(file, "  \"%s\": {\"count\": %lu, \"mean_ms\": %.4f, "
+              "\"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f}%s\n",
+              phase_names[i], s.count, s.mean, s.p50, s.p95, s.p99,
+              (i + 1 < profile_phases) ? "," : "");
+    else
+      fprintf(file, "%s,%lu,%.4f,%.4f,%.4f,%.4f\n", phase_names[i], s.count,
+              s.mean, s.p50, s.p95, s.p99);
+  }
+  if(json)
+    fprintf(file, "}\n");
+  if(fclose(file) != 0)
+    fprintf(stderr, "WARNING: unable to write the profile to %s\n",
+            file_name);
+}
+
+#else
+
+/* ISO C wants something here */
+typedef int profile_compiled_out;
+
+#endif /* NO_PROFILE */
@@ -0,0 +1,51 @@
+#ifndef profile_h
+#define profile_h
+
+#include <stdio.h>
+#include "timer.h"
+
+/* Per-phase frame profiler.  profile_begin() and profile_end() around a
+ * phase put the time it took in a ring of that phase's last profile_samples
+ * times, which profile_report() gives the percentiles of.  The rings are
+ * only written from the GL thread and take no locks.  Built with
+ * -DNO_PROFILE it all compiles to nothing. */
+
+#define profile_samples         1024    /* times kept for each phase */
+
+/* Phases */
+#define profile_frame           0       /* from one frame to the next */
+#define profile_simulate        1
+#define profile_apparatus       2
+#define profile_door            3
+#define profile_forest          4
+#define profile_water_tray      5
+#define profile_water_chute     6
+#define profile_water_tank      7
+#define profile_tree            8
+#define profile_swap            9
+#define profile_phases          10
+
+#ifdef NO_PROFILE
+
+#define profile_begin(phase)    ((void) 0)
+#define profile_end(phase)      ((void) 0)
+#define profile_report(file)    ((void) 0)
+#define profile_dump(file_name) ((void) 0)
+
+#else
+
+extern double profile_starts[profile_phases];
+
+#define profile_begin(phase)    (profile_starts[phase] = timer_now())
+#define profile_end(phase)      profile_record(phase, profile_starts[phase])
+
+/* Put the time since start in the phase's ring */
+void profile_record(int phase, double start);
+/* The count, mean and percentiles of every phase, in milliseconds */
+void profile_report(FILE *);
+/* The same as CSV, or as JSON when the name ends in .json */
+void profile_dump(char const *file_name);
+
+#endif /* NO_PROFILE */
+
+#endif /* profile_h */
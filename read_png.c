@@ -1,106 +1,149 @@
 #include "read_png.h"
 #include <png.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* libpng reports errors here; keep the message for the caller and unwind
+ * to the setjmp() of the call that was running */
+static void decoder_error(png_structp png, png_const_charp message) {
+   struct png_decoder * const d =
+      (struct png_decoder *) png_get_error_ptr(png);
+   snprintf(d->error, sizeof(d->error), "%s", message);
+   png_longjmp(png, 1);
+}
 
-#define MAX_ERROR_MSG 255
-
-static void abort_read(char * file_name) {
-   char error_msg[MAX_ERROR_MSG] = { '\0' };
-   snprintf(error_msg, MAX_ERROR_MSG, "Unable to open image file %s",
-     file_name);
-   perror(error_msg);
-   exit(1);
+static void decoder_warning(png_structp png, png_const_charp message) {
+   /* not worth stopping for */
 }
 
-static int check_image_format(png_structp png, png_infop info) {
-   char * type;
-
-   int const bit_depth = png_get_bit_depth(png, info);
-   int const interlace_type = png_get_interlace_type(png, info);
-   int const color_type = png_get_color_type(png, info);
-   switch(color_type) {
-     case PNG_COLOR_TYPE_GRAY:    type = "Gray";        break;
-     case PNG_COLOR_TYPE_GA:      type = "Gray Alpha";  break;
-     case PNG_COLOR_TYPE_PALETTE: type = "Palette";     break;
-     case PNG_COLOR_TYPE_RGB:     type = "RGB";         break;
-     case PNG_COLOR_TYPE_RGBA:    type = "RGBA";        break;
-     default:                     type = "Unknown";     break;
-   }
+int png_decoder_open(struct png_decoder *d, char const *file_name) {
+   png_structp png;
+   png_infop info;
 
-   if(bit_depth != 8 ||
-      color_type != PNG_COLOR_TYPE_RGB ||
-      interlace_type != PNG_INTERLACE_NONE)
-   {
-     fprintf(stderr,
-         "Image is %dbit, %s, %sinterlaced\n"
-         "Must be 8bit, RGB, non-interlaced.\n",
-         bit_depth, type,
-         (interlace_type == PNG_INTERLACE_NONE) ? "non-" : "");
-     return 0;
+   memset(d, 0, sizeof(*d));
+   d->file = fopen(file_name, "rb");
+   if(!d->file) {
+      snprintf(d->error, sizeof(d->error), "unable to open %s: %s",
+               file_name, strerror(errno));
+      return -1;
    }
-   return 1;
-}
 
-/* Read a PNG file.  Returns the width and height and the data in RGB format.
- * The file must be RGB, 8-bit, non-interlaced. */
-void read_png(char * file_name, unsigned int * width_ptr,
-              unsigned int * height_ptr, GLbyte ** data_ptr) {
+   png = png_create_read_struct(PNG_LIBPNG_VER_STRING, d, decoder_error,
+                                decoder_warning);
+   info = png ? png_create_info_struct(png) : NULL;
+   d->png = png;
+   d->info = info;
+   if(!info) {
+      snprintf(d->error, sizeof(d->error), "out of memory reading %s",
+               file_name);
+      png_decoder_close(d);
+      return -1;
+   }
+   if(setjmp(png_jmpbuf(png))) {
+      png_decoder_close(d);
+      return -1;
+   }
 
-   FILE * file = fopen(file_name, "rb");
-   if( !file ) abort_read(file_name);
+   png_init_io(png, d->file);
+   png_read_info(png, info);
+   d->width = png_get_image_width(png, info);
+   d->height = png_get_image_height(png, info);
+   return 0;
+}
 
-   /* Create and initialize the png_struct with the default error handler
-      functions. */
-   png_structp png_ptr =
-	   png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-   if(!png_ptr) {
-      fclose(file);
-      abort_read(file_name);
+int png_decoder_read(struct png_decoder *d, void *pixels, size_t stride,
+                     int target) {
+   png_structp const png = (png_structp) d->png;
+   png_infop const info = (png_infop) d->info;
+   int const alpha = target != png_target_rgb;
+   int color_type, has_alpha, passes, pass;
+   png_uint_32 row;
+
+   if(setjmp(png_jmpbuf(png)))
+      return -1;
+
+   /* whatever the file holds, expand it to 8 bit RGB or RGBA */
+   color_type = png_get_color_type(png, info);
+   has_alpha = (color_type & PNG_COLOR_MASK_ALPHA) != 0;
+   if(color_type == PNG_COLOR_TYPE_PALETTE)
+      png_set_palette_to_rgb(png);
+   if(color_type == PNG_COLOR_TYPE_GRAY && png_get_bit_depth(png, info) < 8)
+      png_set_expand_gray_1_2_4_to_8(png);
+   if(png_get_valid(png, info, PNG_INFO_tRNS)) {
+      png_set_tRNS_to_alpha(png);
+      has_alpha = 1;
    }
-
-   /* Allocate and initialize the memory for image information. */
-   png_infop info_ptr = png_create_info_struct(png_ptr);
-   if (!info_ptr) {
-      fclose(file);
-      png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
-      abort_read(file_name);
+   if(png_get_bit_depth(png, info) == 16)
+      png_set_strip_16(png);
+   if(!(color_type & PNG_COLOR_MASK_COLOR))
+      png_set_gray_to_rgb(png);
+   if(alpha && !has_alpha)
+      png_set_add_alpha(png, 0xff, PNG_FILLER_AFTER);
+   if(!alpha && has_alpha)
+      png_set_strip_alpha(png);
+   if(target == png_target_bgra)
+      png_set_bgr(png);
+   passes = png_set_interlace_handling(png);
+   png_read_update_info(png, info);
+
+   if(png_get_rowbytes(png, info) != d->width * (alpha ? 4 : 3)) {
+      snprintf(d->error, sizeof(d->error), "unexpected row size");
+      return -1;
+   }
+   if(stride < png_get_rowbytes(png, info)) {
+      snprintf(d->error, sizeof(d->error), "rows of %lu bytes need more than "
+               "a stride of %lu", (unsigned long) png_get_rowbytes(png, info),
+               (unsigned long) stride);
+      return -1;
    }
 
-   /* Set up the input control for using standard C streams */
-   png_init_io(png_ptr, file);
+   /* each pass of an interlaced image fills in more of the same rows */
+   for(pass = 0; pass < passes; pass++)
+      for(row = 0; row < d->height; row++)
+         png_read_row(png, (png_bytep) pixels + row * stride, NULL);
+   png_read_end(png, NULL);
+   return 0;
+}
 
-   int png_transforms = 0; /* No transformations */
+void png_decoder_close(struct png_decoder *d) {
+   png_structp png = (png_structp) d->png;
+   png_infop info = (png_infop) d->info;
 
-   /* Read entire image */
-   png_read_png(png_ptr, info_ptr, png_transforms, NULL);
+   if(png)
+      png_destroy_read_struct(&png, info ? &info : NULL, NULL);
+   if(d->file)
+      fclose(d->file);
+   d->png = d->info = NULL;
+   d->file = NULL;
+}
 
-   png_uint_32 const width = png_get_image_width(png_ptr, info_ptr);
-   png_uint_32 const height = png_get_image_height(png_ptr, info_ptr);
+/* Read a PNG file.  Returns the width and height and the data in RGB
+ * format. */
+void read_png(char * file_name, unsigned int * width_ptr,
+              unsigned int * height_ptr, GLbyte ** data_ptr) {
+   struct png_decoder decoder;
+   GLbyte * data;
 
-   if(!check_image_format(png_ptr, info_ptr))
-   {
-     fprintf(stderr, "Error while processing %s\n", file_name);
-     exit(1);
+   if(png_decoder_open(&decoder, file_name) != 0) {
+      fprintf(stderr, "ERROR: %s\n", decoder.error);
+      exit(1);
    }
-
-   *width_ptr = width;
-   *height_ptr = height;
-   *data_ptr = (GLbyte*) malloc(width*height*3);
-
-   /* Copy the data to the texture array */
-   png_bytepp image_rows = png_get_rows(png_ptr, info_ptr);
-   int const bytes_per_row = png_get_rowbytes(png_ptr, info_ptr);
-   GLbyte * destination = (*data_ptr);
-   for(int row = 0; row < height; ++row) {
-     memcpy(destination, image_rows[row], bytes_per_row);
-     destination += bytes_per_row;
+   data = (GLbyte *) malloc(decoder.width * decoder.height * 3);
+   if(!data) {
+      fprintf(stderr, "ERROR: unable to allocate the image in %s\n",
+              file_name);
+      exit(1);
    }
+   if(png_decoder_read(&decoder, data, decoder.width * 3,
+                       png_target_rgb) != 0) {
+      fprintf(stderr, "ERROR: %s: %s\n", file_name, decoder.error);
+      exit(1);
+   }
+   png_decoder_close(&decoder);
 
-   /* clean up after the read, and free any memory allocated */
-   png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
-
-   /* close the file */
-   fclose(file);
+   *width_ptr = decoder.width;
+   *height_ptr = decoder.height;
+   *data_ptr = data;
 }
-
@@ -1,12 +1,36 @@
 #ifndef read_png_h
 #define read_png_h
 
+#include <stddef.h>
+#include <stdio.h>
 #include <GL/gl.h>
 
+/* Layouts png_decoder_read() can write, 8 bits a channel */
+#define png_target_rgb          0
+#define png_target_rgba         1
+#define png_target_bgra         2
+
+/* A PNG being decoded.  png_decoder_open() reads the header, so that the
+ * caller knows the size before finding room for the pixels, and
+ * png_decoder_read() then decodes the rows straight into that room.  Any
+ * bit depth, colour type and interlacing is converted to the target layout.
+ * Both return 0, or -1 with the reason in error. */
+struct png_decoder {
+  FILE *file;
+  void *png, *info;       /* libpng's read and info structures */
+  unsigned int width, height;
+  char error[160];
+};
+
+int png_decoder_open(struct png_decoder *, char const *file_name);
+/* Rows are stride bytes apart, the first at pixels */
+int png_decoder_read(struct png_decoder *, void *pixels, size_t stride,
+                     int target);
+void png_decoder_close(struct png_decoder *);
+
 /* Read a PNG file.  Returns the width and height and the data in RGB format.
  * A buffer is allocated by the function to hold the data and must be freed by
- * the client.
- * The file must be RGB, 8-bit, non-interlaced. */
+ * the client.  Exits when the file cannot be read. */
 void read_png(char * file_name,
               unsigned int * width_ptr,
               unsigned int * height_ptr,
@@ -0,0 +1,18 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include "rng.h"
+
+/* Expand a 64 bit seed into the generator state with splitmix64, which
+ * also keeps seeds that differ in a single bit well apart. */
+void rng_seed(struct rng *r, uint64_t seed) {
+  int i;
+
+  for(i = 0; i < 4; i += 2) {
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    r->s[i] = (uint32_t) z;
+    r->s[i+1] = (uint32_t) (z >> 32);
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef rng_h
+#define rng_h
+
+#include <stdint.h>
+
+/* xoshiro128+ random number generator.  Each thread keeps its own state, so
+ * no locking is needed and a fixed seed gives a reproducible stream. */
+struct rng {
+  uint32_t s[4];
+};
+
+void rng_seed(struct rng *, uint64_t);
+
+static inline uint32_t rng_next(struct rng *r) {
+  uint32_t const result = r->s[0] + r->s[3];
+  uint32_t const t = r->s[1] << 9;
+
+  r->s[2] ^= r->s[0];
+  r->s[3] ^= r->s[1];
+  r->s[1] ^= r->s[2];
+  r->s[0] ^= r->s[3];
+  r->s[2] ^= t;
+  r->s[3] = (r->s[3] << 11) | (r->s[3] >> 21);
+  return result;
+}
+
+/* Uniform float in [0, 1) from the (best) top 24 bits */
+static inline float rng_float(struct rng *r) {
+  return (rng_next(r) >> 8) * (1.0f / 16777216.0f);
+}
+
+#endif /* rng_h */
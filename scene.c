@@ -0,0 +1,246 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scene.h"
+#include "glcaps.h"
+
+void scene_init(struct scene *s) {
+  memset(s, 0, sizeof(*s));
+  s->use_buffers = -1;
+}
+
+static void *grow_array(void *p, int n, size_t size) {
+  p = realloc(p, n * size);
+  if(!p) {
+    fprintf(stderr, "ERROR: unable to allocate the scene\n");
+    exit(1);
+  }
+  return p;
+}
+
+/* Make room for n more vertices and m more indices */
+static void reserve(struct scene *s, int n, int m) {
+  if(s->vertex_count + n > s->vertex_capacity) {
+    s->vertex_capacity = 2 * (s->vertex_count + n);
+    s->vertices = (GLfloat *) grow_array(s->vertices, s->vertex_capacity,
+                                scene_vertex_floats * sizeof(GLfloat));
+  }
+  if(s->index_count + m > s->index_capacity) {
+    s->index_capacity = 2 * (s->index_count + m);
+    s->indices = (GLuint *) grow_array(s->indices, s->index_capacity,
+                                       sizeof(GLuint));
+  }
+}
+
+int scene_object(struct scene *s, GLenum mode,
+                 struct scene_material const *material) {
+  struct scene_object *o;
+
+  if(s->object_count == s->object_capacity) {
+    s->object_capacity = s->object_capacity ? 2 * s->object_capacity : 16;
+    s->objects = (struct scene_object *)
+      grow_array(s->objects, s->object_capacity, sizeof(struct scene_object));
+  }
+  o = &s->objects[s->object_count];
+  o->mode = mode;
+  o->material = *material;
+  o->first_vertex = s->vertex_count;
+  o->first_index = s->index_count;
+  o->vertex_count = o->index_count = 0;
+  o->changed = 1;
+  return s->object_count++;
+}
+
+GLuint scene_vertex(struct scene *s, GLfloat x, GLfloat y, GLfloat z,
+                    GLfloat const normal[3], GLfloat tex_s, GLfloat tex_t) {
+  GLfloat *v;
+
+  reserve(s, 1, 0);
+  v = &s->vertices[scene_vertex_floats * s->vertex_count];
+  v[0] = x;
+  v[1] = y;
+  v[2] = z;
+  memcpy(v + 3, normal, 3 * sizeof(GLfloat));
+  v[6] = tex_s;
+  v[7] = tex_t;
+  s->objects[s->object_count - 1].vertex_count++;
+  return s->vertex_count++;
+}
+
+static void add_indices(struct scene *s, GLuint const *indices, int n) {
+  reserve(s, 0, n);
+  memcpy(&s->indices[s->index_count], indices, n * sizeof(GLuint));
+  s->index_count += n;
+  s->objects[s->object_count - 1].index_count += n;
+}
+
+void scene_line(struct scene *s, GLuint a, GLuint b) {
+  GLuint const line[2] = {a, b};
+  add_indices(s, line, 2);
+}
+
+void scene_triangle(struct scene *s, GLuint a, GLuint b, GLuint c) {
+  GLuint const triangle[3] = {a, b, c};
+  add_indices(s, triangle, 3);
+}
+
+void scene_quad(struct scene *s, GLuint a, GLuint b, GLuint c, GLuint d) {
+  GLuint const quad[6] = {a, b, c, a, c, d};
+  add_indices(s, quad, 6);
+}
+
+void scene_mesh(struct scene *s, GLfloat const *vertices, int vertex_count,
+                GLuint const *indices, int index_count) {
+  GLuint const base = s->vertex_count;
+  int i;
+
+  reserve(s, vertex_count, index_count);
+  memcpy(&s->vertices[scene_vertex_floats * base], vertices,
+         vertex_count * scene_vertex_floats * sizeof(GLfloat));
+  for(i = 0; i < index_count; i++)
+    s->indices[s->index_count + i] = base + indices[i];
+  s->vertex_count += vertex_count;
+  s->index_count += index_count;
+  s->objects[s->object_count - 1].vertex_count += vertex_count;
+  s->objects[s->object_count - 1].index_count += index_count;
+}
+
+GLfloat *scene_vertices(struct scene *s, int object) {
+  s->objects[object].changed = 1;
+  return &s->vertices[scene_vertex_floats * s->objects[object].first_vertex];
+}
+
+GLuint *scene_indices(struct scene *s, int object) {
+  s->objects[object].changed = 1;
+  return &s->indices[s->objects[object].first_index];
+}
+
+static void find_bounds(struct scene *s, struct scene_object *o) {
+  GLfloat const *v = &s->vertices[scene_vertex_floats * o->first_vertex];
+  int i, k;
+
+  if(o->vertex_count == 0) return;
+  for(k = 0; k < 3; k++)
+    o->bounds.min[k] = o->bounds.max[k] = v[k];
+  for(i = 1; i < o->vertex_count; i++) {
+    v += scene_vertex_floats;
+    for(k = 0; k < 3; k++) {
+      if(v[k] < o->bounds.min[k]) o->bounds.min[k] = v[k];
+      if(v[k] > o->bounds.max[k]) o->bounds.max[k] = v[k];
+    }
+  }
+}
+
+/* Bring the bounds and the GL copies of the changed objects up to date.
+ * New objects mean uploading everything; otherwise only the ranges of the
+ * objects changed are sent. */
+static void update_buffers(struct scene *s) {
+  GLsizeiptr const vertex_size = scene_vertex_floats * sizeof(GLfloat);
+  int const grown = s->buffered_vertices != s->vertex_count ||
+                    s->buffered_indices != s->index_count;
+  int i;
+
+  if(s->use_buffers < 0) {
+    s->use_buffers = gl_version_at_least(1, 5) ||
+                     gl_has_extension("GL_ARB_vertex_buffer_object");
+    if(s->use_buffers)
+      glGenBuffers(2, s->buffers);
+  }
+  if(s->use_buffers) {
+    glBindBuffer(GL_ARRAY_BUFFER, s->buffers[0]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s->buffers[1]);
+  }
+  if(s->use_buffers && grown) {
+    glBufferData(GL_ARRAY_BUFFER, s->vertex_count * vertex_size, s->vertices,
+                 GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, s->index_count * sizeof(GLuint),
+                 s->indices, GL_STATIC_DRAW);
+    s->buffered_vertices = s->vertex_count;
+    s->buffered_indices = s->index_count;
+  }
+
+  for(i = 0; i < s->object_count; i++) {
+    struct scene_object * const o = &s->objects[i];
+
+    if(!o->changed) continue;
+    find_bounds(s, o);
+    if(s->use_buffers && !grown) {
+      glBufferSubData(GL_ARRAY_BUFFER, o->first_vertex * vertex_size,
+                      o->vertex_count * vertex_size,
+                      &s->vertices[scene_vertex_floats * o->first_vertex]);
+      glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                      o->first_index * sizeof(GLuint),
+                      o->index_count * sizeof(GLuint),
+                      &s->indices[o->first_index]);
+    }
+    o->changed = 0;
+  }
+}
+
+static void set_material(struct scene_material const *m) {
+  if(m->texture) {
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glBindTexture(GL_TEXTURE_2D, m->texture);
+  } else {
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, m->colour);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, m->colour);
+    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, m->shininess);
+  }
+}
+
+void scene_draw(struct scene *s, struct frustum const *view,
+                int const *objects, int count) {
+  GLsizei const stride = scene_vertex_floats * sizeof(GLfloat);
+  GLfloat const *vertices = s->vertices;
+  GLuint const *indices = s->indices;
+  struct scene_material const *material = NULL;
+  int i;
+
+  update_buffers(s);
+  if(s->use_buffers) {
+    vertices = NULL;
+    indices = NULL;
+  }
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_NORMAL_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glVertexPointer(3, GL_FLOAT, stride, vertices);
+  glNormalPointer(GL_FLOAT, stride, vertices + 3);
+  glTexCoordPointer(2, GL_FLOAT, stride, vertices + 6);
+
+  for(i = 0; i < count; i++) {
+    struct scene_object const * const o = &s->objects[objects[i]];
+
+    if(view && !frustum_box(view, &o->bounds)) continue;
+    /* only set up the material when it differs from the last one */
+    if(!material || memcmp(material, &o->material, sizeof(*material))) {
+      material = &o->material;
+      set_material(material);
+    }
+    glDrawElements(o->mode, o->index_count, GL_UNSIGNED_INT,
+                   indices + o->first_index);
+  }
+
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_NORMAL_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  if(s->use_buffers) {
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  }
+  if(material && material->texture)
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void scene_free(struct scene *s) {
+  if(s->use_buffers > 0)
+    glDeleteBuffers(2, s->buffers);
+  free(s->vertices);
+  free(s->indices);
+  free(s->objects);
+  scene_init(s);
+}
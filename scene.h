@@ -0,0 +1,72 @@
+#ifndef scene_h
+#define scene_h
+
+#include <GL/gl.h>
+#include "frustum.h"
+
+/* Retained geometry for the apparatus: every object's vertices and indices
+ * live in one vertex buffer and one index buffer, and each object is drawn
+ * with a single glDrawElements(). */
+
+#define scene_vertex_floats     8       /* position, normal, texture coords */
+
+/* How an object looks.  Textured objects show their texture unlit; the
+ * others are lit, with the colour as ambient, diffuse and specular. */
+struct scene_material {
+  GLfloat colour[4];
+  GLfloat shininess;
+  GLuint texture;         /* 0 for none */
+};
+
+/* Its vertices are vertices[first_vertex .. first_vertex+vertex_count) and
+ * its indices, which count from the start of the scene's vertices,
+ * indices[first_index .. first_index+index_count). */
+struct scene_object {
+  GLenum mode;            /* GL_LINES or GL_TRIANGLES */
+  struct scene_material material;
+  int first_vertex, vertex_count;
+  int first_index, index_count;
+  int changed;            /* needs uploading and new bounds */
+  struct box bounds;
+};
+
+struct scene {
+  GLfloat *vertices;
+  GLuint *indices;
+  int vertex_count, vertex_capacity;
+  int index_count, index_capacity;
+  struct scene_object *objects;
+  int object_count, object_capacity;
+  /* copies in GL buffers, when the GL has them */
+  int use_buffers;        /* 1 with buffers, 0 without, -1 not yet known */
+  GLuint buffers[2];      /* vertices and indices */
+  int buffered_vertices;  /* size of the copies */
+  int buffered_indices;
+};
+
+void scene_init(struct scene *);
+/* Start a new object, which the vertices and indices added after it go to.
+ * Returns its number. */
+int scene_object(struct scene *, GLenum mode, struct scene_material const *);
+/* Add a vertex to the newest object.  Returns its index for the lines and
+ * triangles, which are added to the newest object too. */
+GLuint scene_vertex(struct scene *, GLfloat x, GLfloat y, GLfloat z,
+                    GLfloat const normal[3], GLfloat s, GLfloat t);
+void scene_line(struct scene *, GLuint, GLuint);
+void scene_triangle(struct scene *, GLuint, GLuint, GLuint);
+void scene_quad(struct scene *, GLuint, GLuint, GLuint, GLuint);
+/* Add a whole mesh, with vertices laid out as the scene's and indices
+ * counting from its first vertex */
+void scene_mesh(struct scene *, GLfloat const *vertices, int vertex_count,
+                GLuint const *indices, int index_count);
+/* An object's vertices or indices, to be changed in place.  Only the
+ * objects changed are uploaded again, at the next draw. */
+GLfloat *scene_vertices(struct scene *, int object);
+GLuint *scene_indices(struct scene *, int object);
+/* Draw the listed objects in order, leaving out those not in view when a
+ * view is given */
+void scene_draw(struct scene *, struct frustum const *, int const *objects,
+                int count);
+void scene_free(struct scene *);
+
+#endif /* scene_h */
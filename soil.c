@@ -0,0 +1,196 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "soil.h"
+#include "pool.h"
+#include "rng.h"
+
+#define soil_roots      4       /* triangles the square is cut into */
+#define soil_shared     5       /* the corners and centre, shared by them */
+#define vertex_floats   8
+
+int soil_subdivision_depth = 5;        /* level of subdivision used in soil */
+
+/* One of the four triangles being split, on its own thread */
+struct soil_root {
+  struct soil_mesh *mesh;
+  struct rng rng;
+  int next_vertex, next_index;
+  GLfloat shared_normals[soil_shared][3];
+};
+
+struct soil_job {
+  struct soil_mesh *mesh;
+  int depth, workers;
+  uint64_t seed;
+  struct soil_root roots[soil_roots];
+};
+
+static void split(struct soil_root *root, int depth, GLuint a, GLuint b,
+                  GLuint c) {
+  GLfloat * const v = root->mesh->vertices;
+  GLuint * const index = &root->mesh->indices[root->next_index];
+  GLuint n;
+  int i;
+
+  if(depth == 0) {
+    index[0] = a;
+    index[1] = b;
+    index[2] = c;
+    root->next_index += 3;
+    return;
+  }
+
+  /* a new vertex over the centre, raised or lowered a little */
+  n = root->next_vertex++;
+  for(i = 0; i < 3; i++)
+    v[vertex_floats*n + i] = (v[vertex_floats*a + i] +
+                              v[vertex_floats*b + i] +
+                              v[vertex_floats*c + i]) / 3;
+  v[vertex_floats*n + 1] += soil_subdivision_drift *
+                            2*(rng_float(&root->rng) - 0.5);
+  split(root, depth-1, a, b, n);
+  split(root, depth-1, a, n, c);
+  split(root, depth-1, n, b, c);
+}
+
+/* Split a worker's roots, then give their vertices normals averaged over
+ * the triangles around them.  The vertices shared with other roots only
+ * collect this root's part; soil_build() adds those up. */
+static void build_roots(void *arg, int w) {
+  struct soil_job * const job = (struct soil_job *) arg;
+  struct soil_mesh * const mesh = job->mesh;
+  GLfloat * const v = mesh->vertices;
+  int const triangles = (int) pow(3, job->depth);
+  int r, i, k;
+
+  for(r = w; r < soil_roots; r += job->workers) {
+    struct soil_root * const root = &job->roots[r];
+    int const first_vertex = soil_shared + r * (triangles - 1) / 2;
+    int const first_index = r * 3 * triangles;
+
+    root->mesh = mesh;
+    rng_seed(&root->rng, job->seed ^ ((uint64_t) (r + 1) << 48));
+    root->next_vertex = first_vertex;
+    root->next_index = first_index;
+    memset(root->shared_normals, 0, sizeof(root->shared_normals));
+    split(root, job->depth, r, (r + 1) % soil_roots, soil_roots);
+
+    for(i = first_vertex; i < root->next_vertex; i++)
+      v[vertex_floats*i + 3] = v[vertex_floats*i + 4] =
+                               v[vertex_floats*i + 5] = 0.0;
+    for(i = first_index; i < root->next_index; i += 3) {
+      GLuint const * const t = &mesh->indices[i];
+      GLfloat t1[3], t2[3], normal[3];
+
+      /* unnormalised, so that bigger triangles count for more */
+      difference(&v[vertex_floats*t[0]], &v[vertex_floats*t[1]], t1);
+      difference(&v[vertex_floats*t[1]], &v[vertex_floats*t[2]], t2);
+      cross_product(t1, t2, normal);
+      for(k = 0; k < 3; k++) {
+        GLfloat * const n = (t[k] < soil_shared) ?
+                            root->shared_normals[t[k]] :
+                            &v[vertex_floats*t[k] + 3];
+        n[0] += normal[0];
+        n[1] += normal[1];
+        n[2] += normal[2];
+      }
+    }
+    for(i = first_vertex; i < root->next_vertex; i++)
+      normalise(&v[vertex_floats*i + 3]);
+  }
+}
+
+static void *alloc(size_t size) {
+  void * const p = malloc(size);
+
+  if(!p) {
+    fprintf(stderr, "ERROR: unable to allocate the soil\n");
+    exit(1);
+  }
+  return p;
+}
+
+void soil_build(struct soil_mesh *mesh, GLfloat size, GLfloat height,
+                int depth, uint64_t seed) {
+  /* the four corners, then the centre */
+  GLfloat const corners[soil_shared][2] = {
+    {-size/2, -size/2}, {-size/2, size/2}, {size/2, size/2},
+    {size/2, -size/2}, {0.0, 0.0}};
+  struct soil_job job;
+  int const triangles = (int) pow(3, depth);
+  int i, r;
+
+  /* every split adds one vertex and two triangles */
+  mesh->vertex_count = soil_shared + soil_roots * (triangles - 1) / 2;
+  mesh->index_count = soil_roots * 3 * triangles;
+  mesh->vertices = (GLfloat *) alloc(mesh->vertex_count * vertex_floats *
+                                     sizeof(GLfloat));
+  mesh->indices = (GLuint *) alloc(mesh->index_count * sizeof(GLuint));
+  for(i = 0; i < soil_shared; i++) {
+    mesh->vertices[vertex_floats*i] = corners[i][0];
+    mesh->vertices[vertex_floats*i + 1] = height;
+    mesh->vertices[vertex_floats*i + 2] = corners[i][1];
+  }
+
+  job.mesh = mesh;
+  job.depth = depth;
+  job.seed = seed;
+  job.workers = (pool_threads < soil_roots) ? pool_threads : soil_roots;
+  pool_run(build_roots, &job, job.workers);
+
+  for(i = 0; i < soil_shared; i++) {
+    GLfloat * const n = &mesh->vertices[vertex_floats*i + 3];
+
+    n[0] = n[1] = n[2] = 0.0;
+    for(r = 0; r < soil_roots; r++) {
+      n[0] += job.roots[r].shared_normals[i][0];
+      n[1] += job.roots[r].shared_normals[i][1];
+      n[2] += job.roots[r].shared_normals[i][2];
+    }
+    normalise(n);
+  }
+
+  /* the texture lies flat over the soil */
+  for(i = 0; i < mesh->vertex_count; i++) {
+    GLfloat * const vertex = &mesh->vertices[vertex_floats*i];
+
+    vertex[6] = vertex[0] / soil_texture_repeat;
+    vertex[7] = vertex[2] / soil_texture_repeat;
+  }
+}
+
+void soil_free(struct soil_mesh *mesh) {
+  free(mesh->vertices);
+  free(mesh->indices);
+  mesh->vertices = NULL;
+  mesh->indices = NULL;
+  mesh->vertex_count = mesh->index_count = 0;
+}
+
+GLfloat *cross_product(GLfloat m1[3], GLfloat m2[3], GLfloat result[3]) {
+  result[0] = m1[1]*m2[2] - m2[1]*m1[2];
+  result[1] = m2[0]*m1[2] - m1[0]*m2[2];
+  result[2] = m1[0]*m2[1] - m2[0]*m1[1];
+  return result;
+}
+
+void normalise(GLfloat v[3]) {
+  GLfloat length;
+
+  length = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+  v[0] = v[0]/length;
+  v[1] = v[1]/length;
+  v[2] = v[2]/length;
+  return;
+}
+
+GLfloat *difference(GLfloat m1[3], GLfloat m2[3], GLfloat result[3]) {
+  result[0] = m1[0] - m2[0];
+  result[1] = m1[1] - m2[1];
+  result[2] = m1[2] - m2[2];
+  return result;
+}
@@ -0,0 +1,32 @@
+#ifndef soil_h
+#define soil_h
+
+#include <stdint.h>
+#include <GL/gl.h>
+
+#define soil_subdivision_drift  0.5     /* bumpiness of soil */
+#define soil_texture_repeat     2.0     /* size of one copy of the texture */
+
+extern int soil_subdivision_depth;      /* tunable, see config.h */
+
+/* A bumpy square of soil as an indexed triangle mesh.  Each vertex is
+ * position, smooth normal and texture coordinates. */
+struct soil_mesh {
+  GLfloat *vertices;
+  GLuint *indices;
+  int vertex_count, index_count;
+};
+
+/* Build soil of the given size centred on the origin at the given height.
+ * The square is cut into four triangles about its centre, and each is split
+ * depth times about a randomly raised centre point.  The four are built on
+ * the pool's threads, and the same seed always gives the same soil. */
+void soil_build(struct soil_mesh *, GLfloat size, GLfloat height, int depth,
+                uint64_t seed);
+void soil_free(struct soil_mesh *);
+
+GLfloat *cross_product(GLfloat[3], GLfloat[3], GLfloat[3]);
+void normalise(GLfloat[3]);
+GLfloat *difference(GLfloat[3], GLfloat[3], GLfloat[3]);
+
+#endif /* soil_h */
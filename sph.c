@@ -0,0 +1,474 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "3dtree.h"
+#include "sph.h"
+#include "pool.h"
+#include "arena.h"
+
+/* Smallest share of the particles worth handing to another thread */
+#define particles_per_worker    2048
+/* Neighbours looked at together, in a run of them */
+#define sph_run_block           64
+
+/* A worker's share of a step: the particles [begin, end), and the cells
+ * [first_cell, last_cell) whose places in cell order it works out */
+struct sph_worker {
+  int begin, end;
+  int first_cell, last_cell;
+  int total;              /* particles in its cells, from every worker */
+  int offset;             /* where they start in cell order */
+  GLfloat min[3], max[3]; /* bounds of its particles */
+};
+
+/* Cells are numbered along x, then y, then z, so the three cells along x
+ * in each row of a particle's neighbours hold consecutive particles */
+struct grid {
+  GLfloat origin[3];
+  GLfloat cell;           /* size of a cell, no less than sph_radius */
+  int n[3];               /* cells along each axis */
+  int cells;
+};
+
+static struct sph_worker *workers;
+static int worker_count;
+static struct grid grid;
+static struct particles sorted;   /* the particles in cell order */
+static struct particles *particles;
+static struct sph_bounds const *bounds;
+static GLfloat elapsed;
+static int *keys;                 /* the cell of each particle */
+static int *cell_start;           /* first particle of each cell, and end */
+static int *counts;               /* each worker's particles in each cell,
+                                   * then where the next of them goes */
+static int *neighbours;           /* those in reach of each particle */
+static int neighbour_chunks;      /* chunks of rows that take memory */
+static int *neighbour_count;
+static GLfloat *inv_density;      /* 1 over the density of each particle */
+static GLfloat *pressure;
+
+/* The mass of a particle, which makes the rest density 1, and the
+ * constant parts of the smoothing kernels */
+static GLfloat mass, poly6, spiky, viscous;
+
+static void *alloc(size_t size) {
+  void * const p = malloc(size);
+
+  if(!p) {
+    fprintf(stderr, "ERROR: unable to allocate the water interaction\n");
+    exit(1);
+  }
+  return p;
+}
+
+void init_sph(int capacity) {
+  GLfloat const h = sph_radius, s = sph_spacing * sph_radius;
+  int const reach = (int) (h / s);
+  /* the rows are handed back a chunk of particles at a time */
+  size_t const rows = (capacity + particle_chunk - 1) / particle_chunk *
+                      particle_chunk;
+  size_t max_cells;
+  GLfloat sum = 0.0, r2;
+  int x, y, z;
+
+  particles_init(&sorted, capacity);
+  keys = (int *) alloc(capacity * sizeof(int));
+  inv_density = (GLfloat *) alloc(capacity * sizeof(GLfloat));
+  neighbour_count = (int *) alloc(capacity * sizeof(int));
+  /* only as much as the particles fill takes memory */
+  neighbours = (int *) arena_reserve(rows * sph_max_neighbours * sizeof(int));
+  if(!neighbours) {
+    fprintf(stderr, "ERROR: unable to set aside the water's neighbours\n");
+    exit(1);
+  }
+  pressure = (GLfloat *) alloc(capacity * sizeof(GLfloat));
+  /* the grid never has more cells than the particles allow */
+  max_cells = (size_t) sph_cells_per_particle * capacity;
+  cell_start = (int *) alloc((max_cells + 1) * sizeof(int));
+  counts = (int *) alloc(pool_threads * max_cells * sizeof(int));
+  workers = (struct sph_worker *) alloc(pool_threads *
+                                        sizeof(struct sph_worker));
+
+  poly6 = 315.0 / (64.0 * PI * pow(h, 9));
+  spiky = 45.0 / (PI * pow(h, 6));
+  viscous = 45.0 / (PI * pow(h, 6));
+  /* at rest the particles are s apart on a cubic lattice */
+  for(z = -reach; z <= reach; z++)
+    for(y = -reach; y <= reach; y++)
+      for(x = -reach; x <= reach; x++) {
+        r2 = (x*x + y*y + z*z) * s * s;
+        if(r2 < h*h)
+          sum += poly6 * (h*h - r2) * (h*h - r2) * (h*h - r2);
+      }
+  mass = 1.0 / sum;
+}
+
+static int clamp(int i, int n) {
+  return (i < 0) ? 0 : (i >= n) ? n - 1 : i;
+}
+
+static void cell_of(GLfloat x, GLfloat y, GLfloat z, int c[3]) {
+  c[0] = clamp((int) ((x - grid.origin[0]) / grid.cell), grid.n[0]);
+  c[1] = clamp((int) ((y - grid.origin[1]) / grid.cell), grid.n[1]);
+  c[2] = clamp((int) ((z - grid.origin[2]) / grid.cell), grid.n[2]);
+}
+
+/* The particles in the cells around a point, as up to nine runs of
+ * consecutive particles.  Returns the number of runs. */
+static int neighbour_runs(GLfloat x, GLfloat y, GLfloat z, int runs[9][2]) {
+  int c[3], x0, x1, yy, zz, row, n = 0;
+
+  cell_of(x, y, z, c);
+  x0 = (c[0] > 0) ? c[0] - 1 : 0;
+  x1 = (c[0] + 1 < grid.n[0]) ? c[0] + 1 : grid.n[0] - 1;
+  for(zz = c[2] - 1; zz <= c[2] + 1; zz++) {
+    if(zz < 0 || zz >= grid.n[2]) continue;
+    for(yy = c[1] - 1; yy <= c[1] + 1; yy++) {
+      if(yy < 0 || yy >= grid.n[1]) continue;
+      row = (zz * grid.n[1] + yy) * grid.n[0];
+      runs[n][0] = cell_start[row + x0];
+      runs[n][1] = cell_start[row + x1 + 1];
+      if(runs[n][0] < runs[n][1]) n++;
+    }
+  }
+  return n;
+}
+
+static void bound_range(void *arg, int w) {
+  struct sph_worker * const sw = &workers[w];
+  struct particles const * const p = particles;
+  int i;
+
+  sw->min[0] = sw->max[0] = p->x[sw->begin];
+  sw->min[1] = sw->max[1] = p->y[sw->begin];
+  sw->min[2] = sw->max[2] = p->z[sw->begin];
+  for(i = sw->begin + 1; i < sw->end; i++) {
+    if(p->x[i] < sw->min[0]) sw->min[0] = p->x[i];
+    if(p->x[i] > sw->max[0]) sw->max[0] = p->x[i];
+    if(p->y[i] < sw->min[1]) sw->min[1] = p->y[i];
+    if(p->y[i] > sw->max[1]) sw->max[1] = p->y[i];
+    if(p->z[i] < sw->min[2]) sw->min[2] = p->z[i];
+    if(p->z[i] > sw->max[2]) sw->max[2] = p->z[i];
+  }
+}
+
+/* Lay the grid over the particles, with cells a radius across unless that
+ * would make more than a few for each particle */
+static void place_grid(void) {
+  double const max_cells = (double) sph_cells_per_particle * particles->count;
+  GLfloat min[3], max[3];
+  double cells;
+  int w, a;
+
+  for(a = 0; a < 3; a++) {
+    min[a] = workers[0].min[a];
+    max[a] = workers[0].max[a];
+    for(w = 1; w < worker_count; w++) {
+      if(workers[w].min[a] < min[a]) min[a] = workers[w].min[a];
+      if(workers[w].max[a] > max[a]) max[a] = workers[w].max[a];
+    }
+  }
+  grid.cell = sph_radius;
+  for(;;) {
+    cells = 1.0;
+    for(a = 0; a < 3; a++) {
+      grid.origin[a] = min[a];
+      grid.n[a] = (int) ((max[a] - min[a]) / grid.cell) + 1;
+      cells *= grid.n[a];
+    }
+    if(cells <= max_cells) break;
+    grid.cell *= 1.26;
+  }
+  grid.cells = (int) cells;
+}
+
+/* Find the cell of each of the worker's particles, and count how many of
+ * them are in each cell */
+static void key_range(void *arg, int w) {
+  struct sph_worker const * const sw = &workers[w];
+  struct particles const * const p = particles;
+  int * const count = counts + (size_t) w * grid.cells;
+  int c[3], i;
+
+  memset(count, 0, grid.cells * sizeof(int));
+  for(i = sw->begin; i < sw->end; i++) {
+    cell_of(p->x[i], p->y[i], p->z[i], c);
+    keys[i] = (c[2] * grid.n[1] + c[1]) * grid.n[0] + c[0];
+    count[keys[i]]++;
+  }
+}
+
+/* Count the particles of every worker in the worker's cells */
+static void sum_cells(void *arg, int w) {
+  struct sph_worker * const sw = &workers[w];
+  int c, v, total = 0;
+
+  for(c = sw->first_cell; c < sw->last_cell; c++)
+    for(v = 0; v < worker_count; v++)
+      total += counts[(size_t) v * grid.cells + c];
+  sw->total = total;
+}
+
+/* Number the worker's cells, and within each cell every worker's
+ * particles, in cell order, so that counts holds where each worker's next
+ * particle in the cell goes */
+static void place_cells(void *arg, int w) {
+  struct sph_worker const * const sw = &workers[w];
+  int c, v, k, next = sw->offset;
+
+  for(c = sw->first_cell; c < sw->last_cell; c++) {
+    cell_start[c] = next;
+    for(v = 0; v < worker_count; v++) {
+      k = counts[(size_t) v * grid.cells + c];
+      counts[(size_t) v * grid.cells + c] = next;
+      next += k;
+    }
+  }
+}
+
+/* Copy the worker's particles to their places in cell order.  Within a
+ * cell they keep their order, as the workers' particles come one worker
+ * after another. */
+static void scatter_range(void *arg, int w) {
+  struct sph_worker const * const sw = &workers[w];
+  struct particles const * const p = particles;
+  int * const next = counts + (size_t) w * grid.cells;
+  int i, d;
+
+  for(i = sw->begin; i < sw->end; i++) {
+    d = next[keys[i]]++;
+    sorted.x[d] = p->x[i];
+    sorted.y[d] = p->y[i];
+    sorted.z[d] = p->z[i];
+    sorted.vx[d] = p->vx[i];
+    sorted.vy[d] = p->vy[i];
+    sorted.vz[d] = p->vz[i];
+  }
+}
+
+/* Find the density of each particle from those in reach of it, noting
+ * which they are for the force pass */
+static void density_range(void *arg, int w) {
+  struct sph_worker const * const sw = &workers[w];
+  GLfloat const * restrict const x = sorted.x;
+  GLfloat const * restrict const y = sorted.y;
+  GLfloat const * restrict const z = sorted.z;
+  GLfloat const h2 = sph_radius * sph_radius;
+  GLfloat near[sph_run_block];
+  int runs[9][2];
+  int i, j, r, n, m, first, last;
+
+  for(i = sw->begin; i < sw->end; i++) {
+    GLfloat const xi = x[i], yi = y[i], zi = z[i];
+    int * restrict const list = neighbours + (size_t) i * sph_max_neighbours;
+    GLfloat sum = 0.0, rho;
+
+    n = neighbour_runs(xi, yi, zi, runs);
+    m = 0;
+    for(r = 0; r < n; r++)
+      for(first = runs[r][0]; first < runs[r][1]; first = last) {
+        last = (runs[r][1] - first < sph_run_block) ? runs[r][1]
+                                                     : first + sph_run_block;
+        /* the distances a block at a time, so that this loop vectorises */
+        for(j = first; j < last; j++) {
+          GLfloat const dx = xi - x[j], dy = yi - y[j], dz = zi - z[j];
+          GLfloat const d2 = dx*dx + dy*dy + dz*dz;
+          GLfloat const q = (d2 < h2) ? h2 - d2 : 0.0;
+
+          sum += q * q * q;
+          near[j - first] = d2;
+        }
+        /* and those in reach, itself included, noted without a branch */
+        if(m + (last - first) <= sph_max_neighbours)
+          for(j = first; j < last; j++) {
+            list[m] = j;
+            m += near[j - first] < h2;
+          }
+        else
+          for(j = first; j < last && m < sph_max_neighbours; j++)
+            if(near[j - first] < h2)
+              list[m++] = j;
+      }
+    neighbour_count[i] = m;
+    /* a particle always counts itself, so this is never 0 */
+    rho = mass * poly6 * sum;
+    inv_density[i] = 1.0 / rho;
+    /* only crowding pushes, so a thin flow does not pull itself together */
+    pressure[i] = (rho > 1.0) ? sph_stiffness * (rho - 1.0) : 0.0;
+  }
+}
+
+/* Accelerate each particle by the pressure and viscosity of those in
+ * reach of it, reading the particles in cell order and writing them back
+ * to the store, with their new velocities and positions across the chute,
+ * so that every particle sees the old ones */
+static void force_range(void *arg, int w) {
+  struct sph_worker const * const sw = &workers[w];
+  struct particles * const p = particles;
+  GLfloat const * restrict const x = sorted.x;
+  GLfloat const * restrict const y = sorted.y;
+  GLfloat const * restrict const z = sorted.z;
+  GLfloat const * restrict const vx = sorted.vx;
+  GLfloat const * restrict const vy = sorted.vy;
+  GLfloat const * restrict const vz = sorted.vz;
+  GLfloat const * restrict const inv_rho = inv_density;
+  GLfloat const * restrict const pr = pressure;
+  GLfloat const h = sph_radius;
+  GLfloat const drag_scale = sph_viscosity * mass * viscous;
+  GLfloat const push_scale = 0.5 * mass * spiky;
+  /* no particle is pushed more than half a radius a step */
+  GLfloat const max_dv = 0.5 * h / elapsed;
+  GLfloat const *n = bounds->normal;
+  int i, j, k;
+
+  for(i = sw->begin; i < sw->end; i++) {
+    int const * const list = neighbours + (size_t) i * sph_max_neighbours;
+    GLfloat const xi = x[i], yi = y[i], zi = z[i];
+    GLfloat const vxi = vx[i], vyi = vy[i], vzi = vz[i], pi = pr[i];
+    GLfloat drag[3] = {0.0, 0.0, 0.0}, push[3] = {0.0, 0.0, 0.0};
+    GLfloat a[3], dv, xn;
+
+    for(k = 0; k < neighbour_count[i]; k++) {
+      GLfloat dx, dy, dz, inv_d, q, dr, pu;
+
+      j = list[k];
+      dx = xi - x[j];
+      dy = yi - y[j];
+      dz = zi - z[j];
+      /* a particle is on its own list, but is no distance from itself and
+       * moves at no speed relative to itself, so it adds nothing */
+      inv_d = 1.0 / sqrt(dx*dx + dy*dy + dz*dz + 1e-12);
+      q = h - (dx*dx + dy*dy + dz*dz) * inv_d;
+      dr = q * inv_rho[j];
+      pu = (pi + pr[j]) * inv_rho[j] * q * q * inv_d;
+      drag[0] += dr * (vx[j] - vxi);
+      drag[1] += dr * (vy[j] - vyi);
+      drag[2] += dr * (vz[j] - vzi);
+      push[0] += pu * dx;
+      push[1] += pu * dy;
+      push[2] += pu * dz;
+    }
+    a[0] = (drag_scale * drag[0] + push_scale * push[0]) * inv_rho[i];
+    a[1] = (drag_scale * drag[1] + push_scale * push[1]) * inv_rho[i];
+    a[2] = (drag_scale * drag[2] + push_scale * push[2]) * inv_rho[i];
+
+    /* on the chute only the part along its surface counts */
+    if(zi <= bounds->end_of_chute) {
+      GLfloat const into = a[0]*n[0] + a[1]*n[1] + a[2]*n[2];
+
+      a[0] -= into * n[0];
+      a[1] -= into * n[1];
+      a[2] -= into * n[2];
+    }
+    dv = sqrt(a[0]*a[0] + a[1]*a[1] + a[2]*a[2]) * elapsed;
+    if(dv > max_dv) {
+      a[0] *= max_dv / dv;
+      a[1] *= max_dv / dv;
+      a[2] *= max_dv / dv;
+    }
+    p->vx[i] = vxi + a[0] * elapsed;
+    p->vy[i] = vyi + a[1] * elapsed;
+    p->vz[i] = vzi + a[2] * elapsed;
+
+    /* the kernels move them down the chute, but not across it */
+    xn = xi + p->vx[i] * elapsed;
+    if(zi <= bounds->end_of_chute) {
+      if(xn < bounds->x_min) {
+        xn = bounds->x_min;
+        p->vx[i] = 0.0;
+      } else if(xn > bounds->x_max) {
+        xn = bounds->x_max;
+        p->vx[i] = 0.0;
+      }
+    }
+    p->x[i] = xn;
+    p->y[i] = yi;
+    p->z[i] = zi;
+  }
+}
+
+/* Share the particles out between as many workers as are worth it, and
+ * the cells between the same workers */
+static void split_work(int count) {
+  int w, share;
+
+  worker_count = (count + particles_per_worker - 1) / particles_per_worker;
+  if(worker_count > pool_threads) worker_count = pool_threads;
+  share = (count + worker_count - 1) / worker_count;
+  /* rounding up can leave the last workers nothing */
+  while(worker_count > 1 && (worker_count - 1) * share >= count)
+    worker_count--;
+  for(w = 0; w < worker_count; w++) {
+    workers[w].begin = w * share;
+    workers[w].end = (w + 1 < worker_count) ? (w + 1) * share : count;
+  }
+}
+
+/* Give back the memory above what the live particles use, as
+ * particles_trim() does for the copy: the neighbour rows go a chunk of
+ * particles at a time, keeping one chunk spare */
+static void trim(int count) {
+  int const used = (count + particle_chunk - 1) / particle_chunk;
+  size_t const chunk_size = (size_t) particle_chunk * sph_max_neighbours;
+
+  sorted.count = count;
+  particles_trim(&sorted);
+
+  if(used > neighbour_chunks) neighbour_chunks = used;
+  if(neighbour_chunks <= used + 1) return;
+  arena_release(neighbours + (used + 1) * chunk_size,
+                (neighbour_chunks - used - 1) * chunk_size * sizeof(int));
+  neighbour_chunks = used + 1;
+}
+
+void sph_step(struct particles *p, struct sph_bounds const *b,
+              GLfloat step) {
+  int w, offset;
+
+  if(p->count < 2) {
+    trim(p->count);
+    return;
+  }
+  particles = p;
+  bounds = b;
+  elapsed = step;
+  split_work(p->count);
+
+  /* sort the particles into cell order: each worker counts its own
+   * particles in each cell, the places of the cells are worked out a range
+   * of cells to a worker, and each worker then copies its own particles */
+  pool_run(bound_range, NULL, worker_count);
+  place_grid();
+  pool_run(key_range, NULL, worker_count);
+  for(w = 0; w < worker_count; w++) {
+    workers[w].first_cell = (int) ((long) grid.cells * w / worker_count);
+    workers[w].last_cell = (int) ((long) grid.cells * (w + 1) /
+                                  worker_count);
+  }
+  pool_run(sum_cells, NULL, worker_count);
+  for(w = 0, offset = 0; w < worker_count; w++) {
+    workers[w].offset = offset;
+    offset += workers[w].total;
+  }
+  pool_run(place_cells, NULL, worker_count);
+  pool_run(scatter_range, NULL, worker_count);
+  cell_start[grid.cells] = p->count;
+
+  /* the forces are found from the copy, and the particles written back to
+   * their own store, so each store keeps its own arrays */
+  pool_run(density_range, NULL, worker_count);
+  pool_run(force_range, NULL, worker_count);
+
+  /* the copy and the lists have been written as far as the particles
+   * reach */
+  trim(p->count);
+}
+
+size_t sph_memory(void) {
+  return particles_memory(&sorted) +
+         (size_t) neighbour_chunks * particle_chunk * sph_max_neighbours *
+         sizeof(int);
+}
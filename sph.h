@@ -0,0 +1,37 @@
+#ifndef sph_h
+#define sph_h
+
+#include <GL/gl.h>
+#include "water.h"
+
+/* Smoothed particle hydrodynamics for the water: the particles near each
+ * other push apart where they crowd together and drag each other along, so
+ * the flow spreads and splashes.  Each step the particles are sorted by the
+ * cell of a uniform grid they are in, so that those near each other are
+ * near each other in memory, and their densities and then forces are
+ * found from the particles in the neighbouring cells. */
+
+#define sph_radius              0.06    /* smoothing radius */
+#define sph_spacing             0.75    /* rest spacing, in radii */
+#define sph_stiffness           4.0     /* pressure per unit compression */
+#define sph_viscosity           0.02
+#define sph_max_neighbours      96      /* in reach of a particle, at most */
+#define sph_cells_per_particle  8       /* in the grid, at most */
+
+/* Where the particles are held to the chute.  Beyond end_of_chute they fly
+ * freely; before it they stay on its surface, between its sides. */
+struct sph_bounds {
+  GLfloat end_of_chute;
+  GLfloat normal[3];      /* of the chute's surface, pointing up */
+  GLfloat x_min, x_max;   /* sides of the chute */
+};
+
+void init_sph(int capacity);
+/* Change the velocities of the particles, and their positions across the
+ * chute, for the forces between them over a step.  The particles are left
+ * in a new order. */
+void sph_step(struct particles *, struct sph_bounds const *, GLfloat elapsed);
+/* Memory taken by the copy of the particles and their neighbour lists */
+size_t sph_memory(void);
+
+#endif /* sph_h */
@@ -0,0 +1,160 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stream.h"
+#include "glcaps.h"
+
+char const * const stream_mode_names[] = {
+  "client arrays", "orphaned buffer", "persistent ring"
+};
+
+void stream_init(struct stream *s) {
+  char const * const requested = getenv("STREAM_MODE");
+  int i;
+
+  s->buffer = 0;
+  s->size = 0;
+  s->section = 0;
+  s->memory = NULL;
+  for(i = 0; i < stream_sections; i++)
+    s->fences[i] = 0;
+
+  if(gl_version_at_least(4, 4) ||
+     gl_has_extension("GL_ARB_buffer_storage"))
+    s->mode = stream_persistent;
+  else if(gl_version_at_least(1, 5) ||
+          gl_has_extension("GL_ARB_vertex_buffer_object"))
+    s->mode = stream_orphan;
+  else
+    s->mode = stream_client;
+
+  /* STREAM_MODE=client or orphan steps down to a simpler path */
+  if(requested && strcmp(requested, "client") == 0)
+    s->mode = stream_client;
+  else if(requested && strcmp(requested, "orphan") == 0 &&
+          s->mode == stream_persistent)
+    s->mode = stream_orphan;
+
+  if(s->mode != stream_client)
+    glGenBuffers(1, &s->buffer);
+}
+
+/* Make room for size bytes per section, dropping the old storage */
+static void stream_grow(struct stream *s, GLsizeiptr size) {
+  int i;
+
+  /* round up so that a slowly growing flow does not reallocate every frame */
+  size = (size * 3 / 2 + 4095) & ~(GLsizeiptr) 4095;
+
+  switch(s->mode) {
+  case stream_client:
+    free(s->memory);
+    s->memory = (char *) malloc(size);
+    if(!s->memory) {
+      fprintf(stderr, "ERROR: unable to allocate a vertex array\n");
+      exit(1);
+    }
+    break;
+  case stream_orphan:
+    /* storage is (re)specified by every stream_map() */
+    break;
+  case stream_persistent:
+    /* storage is immutable, so a bigger ring needs a new buffer */
+    for(i = 0; i < stream_sections; i++) {
+      if(s->fences[i]) glDeleteSync(s->fences[i]);
+      s->fences[i] = 0;
+    }
+    if(s->memory) {
+      glBindBuffer(GL_ARRAY_BUFFER, s->buffer);
+      glUnmapBuffer(GL_ARRAY_BUFFER);
+      glDeleteBuffers(1, &s->buffer);
+      glGenBuffers(1, &s->buffer);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, s->buffer);
+    glBufferStorage(GL_ARRAY_BUFFER, size * stream_sections, NULL,
+                    GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                    GL_MAP_COHERENT_BIT);
+    s->memory = (char *) glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                                          size * stream_sections,
+                                          GL_MAP_WRITE_BIT |
+                                          GL_MAP_PERSISTENT_BIT |
+                                          GL_MAP_COHERENT_BIT);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if(!s->memory) {
+      /* fall back to orphaning, in a buffer whose storage can be
+       * respecified, unlike the immutable one just made */
+      fprintf(stderr, "WARNING: persistent mapping failed, "
+                      "streaming with glBufferData\n");
+      glDeleteBuffers(1, &s->buffer);
+      glGenBuffers(1, &s->buffer);
+      s->mode = stream_orphan;
+    }
+    break;
+  }
+  s->size = size;
+}
+
+/* Space for this frame's data, at least size bytes */
+void *stream_map(struct stream *s, GLsizeiptr size) {
+  void *p;
+
+  if(size > s->size)
+    stream_grow(s, size);
+
+  switch(s->mode) {
+  case stream_client:
+    return s->memory;
+  case stream_orphan:
+    /* orphan the old storage so the GL need not wait for the last draw */
+    glBindBuffer(GL_ARRAY_BUFFER, s->buffer);
+    glBufferData(GL_ARRAY_BUFFER, s->size, NULL, GL_STREAM_DRAW);
+    p = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+    if(p) return p;
+    /* fall back to client memory, which cannot fail to map */
+    fprintf(stderr, "WARNING: mapping the vertex buffer failed, "
+                    "streaming from client memory\n");
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDeleteBuffers(1, &s->buffer);
+    s->buffer = 0;
+    s->mode = stream_client;
+    stream_grow(s, size);
+    return s->memory;
+  case stream_persistent:
+    s->section = (s->section + 1) % stream_sections;
+    if(s->fences[s->section]) {
+      /* wait until the GL has finished reading this section */
+      glClientWaitSync(s->fences[s->section], GL_SYNC_FLUSH_COMMANDS_BIT,
+                       1000000000);
+      glDeleteSync(s->fences[s->section]);
+      s->fences[s->section] = 0;
+    }
+    return s->memory + s->section * s->size;
+  }
+  return NULL;
+}
+
+/* Finish writing.  Leaves the buffer bound and returns the pointer to pass
+ * to the gl*Pointer() calls. */
+GLvoid const *stream_unmap(struct stream *s) {
+  switch(s->mode) {
+  case stream_client:
+    return s->memory;
+  case stream_orphan:
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    return (GLvoid const *) 0;
+  case stream_persistent:
+    glBindBuffer(GL_ARRAY_BUFFER, s->buffer);
+    return (GLvoid const *) (s->section * s->size);
+  }
+  return NULL;
+}
+
+/* Call once the draws reading this frame's data have been issued */
+void stream_done(struct stream *s) {
+  if(s->mode == stream_persistent)
+    s->fences[s->section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  if(s->mode != stream_client)
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,35 @@
+#ifndef stream_h
+#define stream_h
+
+#include <GL/gl.h>
+
+#define stream_sections         3       /* frames in flight in the ring */
+
+/* How the data reaches the GL */
+enum stream_mode {
+  stream_client,        /* plain vertex arrays from client memory */
+  stream_orphan,        /* buffer object, orphaned and refilled each frame */
+  stream_persistent     /* persistently mapped ring, fenced per section */
+};
+
+/* Vertex data that is rewritten every frame.  Usage:
+ *   p = stream_map(&s, bytes);   fill p
+ *   glVertexPointer(..., stream_unmap(&s));   draw
+ *   stream_done(&s); */
+struct stream {
+  enum stream_mode mode;
+  GLuint buffer;
+  GLsizeiptr size;                      /* bytes per section */
+  int section;                          /* section being written */
+  char *memory;                         /* mapping or client memory */
+  GLsync fences[stream_sections];
+};
+
+extern char const * const stream_mode_names[];
+
+void stream_init(struct stream *);
+void *stream_map(struct stream *, GLsizeiptr);
+GLvoid const *stream_unmap(struct stream *);
+void stream_done(struct stream *);
+
+#endif /* stream_h */
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Run the whole simulation and drawing offscreen for every combination of
+# the given settings, and add a line of frame time percentiles and memory
+# use for each to one CSV file (see -summary in 3dtree.c):
+#
+#   ./sweep.sh [-frames n] [-summary file.csv] [name=v1,v2,...]... [options]
+#
+# Each name is threads or a tunable that 3dtree -set takes (see config.h);
+# anything else is handed to every run of 3dtree as it is.  For example
+#
+#   ./sweep.sh threads=1,2,4,8 water_particles=20000,200000 \
+#     soil_subdivision_depth=5,8 -sph
+
+frames=300
+summary=sweep.csv
+options=
+runs=$(mktemp) || exit 1
+shots=$(mktemp -d) || exit 1
+trap 'rm -rf "$runs" "$runs.next" "$shots"' EXIT
+
+# one line of options for each combination, built up a setting at a time
+echo > "$runs"
+while [ $# -gt 0 ]; do
+  case $1 in
+  -frames) frames=$2; shift ;;
+  -summary) summary=$2; shift ;;
+  *=*)
+    name=${1%%=*}
+    [ "$name" = threads ] && flag="-threads " || flag="-set $name="
+    : > "$runs.next"
+    while read -r line; do
+      for value in $(echo "${1#*=}" | tr , ' '); do
+        echo "$line $flag$value" >> "$runs.next"
+      done
+    done < "$runs"
+    mv "$runs.next" "$runs" ;;
+  *) options="$options $1" ;;
+  esac
+  shift
+done
+
+while read -r line; do
+  echo "3dtree $line$options"
+  ./3dtree -offscreen "$frames" -seed 1 -out "$shots" -summary "$summary" \
+    $line $options < /dev/null > /dev/null || exit 1
+done < "$runs"
@@ -0,0 +1,266 @@
+/* vi:set sw=2 ts=2 et: */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "textures.h"
+#include "read_png.h"
+
+#define texture_version 1
+#define name_length     256
+
+uint64_t fnv1a(void const *data, size_t size) {
+  unsigned char const *p = (unsigned char const *) data;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  size_t i;
+
+  for(i = 0; i < size; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static unsigned int count_levels(unsigned int size) {
+  unsigned int levels = 1;
+
+  while(size > 1) {
+    size /= 2;
+    levels++;
+  }
+  return levels;
+}
+
+/* Bytes in the whole mip chain */
+static size_t chain_size(unsigned int size) {
+  size_t bytes = 0;
+
+  for(; size > 0; size /= 2)
+    bytes += 3 * size * size;
+  return bytes;
+}
+
+/* Map a whole file for reading; NULL when it cannot be */
+static void *map_file(char const *file_name, size_t *size) {
+  struct stat st;
+  void *p;
+  int fd = open(file_name, O_RDONLY);
+
+  if(fd < 0) return NULL;
+  if(fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED) return NULL;
+  *size = st.st_size;
+  return p;
+}
+
+/* wood.png is cached in wood.tex */
+static void cache_name(char const *png_name, char *name, size_t size) {
+  size_t const n = strlen(png_name);
+
+  if(n > 4 && strcmp(png_name + n - 4, ".png") == 0)
+    snprintf(name, size, "%.*s.tex", (int) (n - 4), png_name);
+  else
+    snprintf(name, size, "%s.tex", png_name);
+}
+
+/* Map the cache if it holds the texture at this size, cooked from a PNG
+ * with this hash.  Without a hash any cooked texture of the size will do.
+ * Returns 0 when it does not. */
+static int map_cache(struct texture_image *t, char const *name,
+                     unsigned int size, uint64_t const *hash) {
+  struct texture_header const *header;
+  size_t mapping_size;
+  void * const mapping = map_file(name, &mapping_size);
+
+  if(!mapping) return 0;
+  header = (struct texture_header const *) mapping;
+  if(mapping_size != sizeof(*header) + chain_size(size) ||
+     memcmp(header->magic, "3DTX", 4) != 0 ||
+     header->version != texture_version ||
+     header->size != size || header->levels != count_levels(size) ||
+     (hash && header->source_hash != *hash)) {
+    munmap(mapping, mapping_size);
+    return 0;
+  }
+
+  t->size = size;
+  t->levels = header->levels;
+  t->data = (GLubyte const *) mapping + sizeof(*header);
+  t->mapping = mapping;
+  t->mapping_size = mapping_size;
+  t->pixels = NULL;
+  return 1;
+}
+
+/* Write the cache through a temporary file, so that another run never
+ * maps half of it */
+static void write_cache(struct texture_image const *t, char const *name,
+                        uint64_t hash) {
+  struct texture_header header;
+  char temporary[name_length + 16];
+  FILE *file;
+  int written;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "3DTX", 4);
+  header.version = texture_version;
+  header.source_hash = hash;
+  header.size = t->size;
+  header.levels = t->levels;
+
+  snprintf(temporary, sizeof(temporary), "%s.%ld", name, (long) getpid());
+  file = fopen(temporary, "wb");
+  if(!file) {
+    fprintf(stderr, "WARNING: unable to write the texture cache %s\n", name);
+    return;
+  }
+  written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(t->data, chain_size(t->size), 1, file) == 1;
+  if(fclose(file) != 0 || !written || rename(temporary, name) != 0) {
+    fprintf(stderr, "WARNING: unable to write the texture cache %s\n", name);
+    remove(temporary);
+  }
+}
+
+/* Resample a line of texels by averaging those under each new texel,
+ * weighted by how much of them it covers.  Texels are stride floats
+ * apart. */
+static void resample(float const *from, int from_size, float *to,
+                     int to_size, int stride) {
+  float const step = (float) from_size / to_size;
+  int i, j, c;
+
+  for(i = 0; i < to_size; i++) {
+    float const start = i * step, end = (i + 1) * step;
+    float sum[3] = {0.0, 0.0, 0.0};
+
+    for(j = (int) start; j < end && j < from_size; j++) {
+      float const weight = ((j + 1 < end) ? j + 1 : end) -
+                           ((j > start) ? j : start);
+      for(c = 0; c < 3; c++)
+        sum[c] += weight * from[j*stride + c];
+    }
+    for(c = 0; c < 3; c++)
+      to[i*stride + c] = sum[c] / step;
+  }
+}
+
+/* Scale an RGB image to size x size */
+static void scale_image(GLubyte const *image, int width, int height,
+                        GLubyte *scaled, int size) {
+  float * const source = (float *) malloc(3 * width * height * sizeof(float));
+  float * const rows = (float *) malloc(3 * size * height * sizeof(float));
+  float * const result = (float *) malloc(3 * size * size * sizeof(float));
+  int i;
+
+  if(!source || !rows || !result) {
+    fprintf(stderr, "ERROR: unable to allocate a texture\n");
+    exit(1);
+  }
+  for(i = 0; i < 3 * width * height; i++)
+    source[i] = image[i];
+  /* along the rows, then down the columns */
+  for(i = 0; i < height; i++)
+    resample(source + 3*width*i, width, rows + 3*size*i, size, 3);
+  for(i = 0; i < size; i++)
+    resample(rows + 3*i, height, result + 3*i, size, 3*size);
+  for(i = 0; i < 3 * size * size; i++)
+    scaled[i] = (GLubyte) (result[i] + 0.5);
+
+  free(source);
+  free(rows);
+  free(result);
+}
+
+void texture_cook(struct texture_image *t, char const *png_name, int size) {
+  unsigned int width, height, level, s, x, y, c;
+  GLbyte *image;
+  GLubyte *from, *to;
+
+  read_png((char *) png_name, &width, &height, &image);
+
+  t->size = size;
+  t->levels = count_levels(size);
+  t->pixels = (GLubyte *) malloc(chain_size(size));
+  if(!t->pixels) {
+    fprintf(stderr, "ERROR: unable to allocate a texture\n");
+    exit(1);
+  }
+  scale_image((GLubyte const *) image, width, height, t->pixels, size);
+  free(image);
+
+  /* each level averages squares of four texels of the one above */
+  from = t->pixels;
+  for(level = 1, s = size / 2; level < t->levels; level++, s /= 2) {
+    to = from + 3 * (2*s) * (2*s);
+    for(y = 0; y < s; y++)
+      for(x = 0; x < s; x++)
+        for(c = 0; c < 3; c++)
+          to[3*(s*y + x) + c] = (from[3*(2*s*(2*y) + 2*x) + c] +
+                                 from[3*(2*s*(2*y) + 2*x+1) + c] +
+                                 from[3*(2*s*(2*y+1) + 2*x) + c] +
+                                 from[3*(2*s*(2*y+1) + 2*x+1) + c] + 2) / 4;
+    from = to;
+  }
+
+  t->data = t->pixels;
+  t->mapping = NULL;
+  t->mapping_size = 0;
+}
+
+void texture_load(struct texture_image *t, char const *png_name, int size) {
+  char name[name_length];
+  size_t source_size;
+  void * const source = map_file(png_name, &source_size);
+  uint64_t hash = 0;
+
+  if(source) {
+    hash = fnv1a(source, source_size);
+    munmap(source, source_size);
+  }
+  cache_name(png_name, name, sizeof(name));
+  /* without the PNG, whatever was cooked last is all there is */
+  if(map_cache(t, name, size, source ? &hash : NULL))
+    return;
+
+  texture_cook(t, png_name, size);
+  write_cache(t, name, hash);
+}
+
+void texture_upload(struct texture_image const *t, GLuint texture) {
+  GLubyte const *level = t->data;
+  unsigned int i, s;
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  /* the rows of the smallest levels are not a multiple of four bytes */
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for(i = 0, s = t->size; i < t->levels; i++, s /= 2) {
+    glTexImage2D(GL_TEXTURE_2D, i, GL_RGB, s, s, 0, GL_RGB, GL_UNSIGNED_BYTE,
+                 level);
+    level += 3 * s * s;
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void texture_release(struct texture_image *t) {
+  if(t->mapping)
+    munmap(t->mapping, t->mapping_size);
+  free(t->pixels);
+  memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,54 @@
+#ifndef textures_h
+#define textures_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <GL/gl.h>
+
+/* Cooked textures.  A PNG is scaled to a square power of two and given its
+ * mip chain once, and the result cached beside it (wood.png in wood.tex)
+ * with an FNV-1a hash of the PNG.  Later runs map the cache and upload it
+ * as it is, until the PNG changes. */
+
+#define texture_size            128     /* width and height of the top level */
+
+struct texture_image {
+  unsigned int size;      /* of the top level */
+  unsigned int levels;    /* in the mip chain, down to 1x1 */
+  GLubyte const *data;    /* RGB, every level in turn from the top */
+  void *mapping;          /* the cache file, when it is mapped */
+  size_t mapping_size;
+  GLubyte *pixels;        /* the data, when it was cooked here */
+};
+
+/* The cooked file, followed by the levels */
+struct texture_header {
+  char magic[4];          /* "3DTX" */
+  uint32_t version;
+  uint64_t source_hash;
+  uint32_t size, levels;
+};
+
+/* Load a texture from its cache, or cook it and write the cache when the
+ * cache is missing or stale.  Needs no GL context. */
+void texture_load(struct texture_image *, char const *png_name, int size);
+/* Decode and cook the PNG without touching the cache */
+void texture_cook(struct texture_image *, char const *png_name, int size);
+/* Upload every level to the texture object, which is left bound */
+void texture_upload(struct texture_image const *, GLuint texture);
+void texture_release(struct texture_image *);
+
+uint64_t fnv1a(void const *, size_t);
+
+/* Textures cooked when the program was built, by embed_textures into
+ * embedded_textures.c, laid out as a texture_image's data */
+struct embedded_texture {
+  char const *name;       /* of the PNG it was cooked from */
+  unsigned int size, levels;
+  GLubyte const *data;
+};
+
+extern struct embedded_texture const embedded_textures[];
+extern int const embedded_texture_count;
+
+#endif /* textures_h */
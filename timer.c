@@ -0,0 +1,63 @@
+/* vi:set sw=2 ts=2 et: */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <time.h>
+#include <math.h>
+#include "timer.h"
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+double timer_now() {
+#ifdef WIN32
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER now;
+
+  if(frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&now);
+  return (double) now.QuadPart / (double) frequency.QuadPart;
+#else
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+void sim_clock_start(struct sim_clock *c) {
+  c->last = timer_now();
+  c->accumulator = 0.0;
+}
+
+/* Number of fixed steps to simulate this frame.  After a slow frame at most
+ * sim_max_substeps are run and the rest of the backlog is dropped, so the
+ * simulation slows down rather than falling further behind.  Only whole
+ * steps are dropped, so the interpolation stays where the clock says. */
+int sim_clock_steps(struct sim_clock *c) {
+  double const now = timer_now();
+  int steps;
+
+  c->accumulator += now - c->last;
+  c->last = now;
+
+  if(c->fast_forward) {
+    c->accumulator = fmod(c->accumulator, sim_step);
+    return sim_fast_forward_steps;
+  }
+
+  steps = (int) (c->accumulator / sim_step);
+  if(steps > sim_max_substeps) {
+    steps = sim_max_substeps;
+    c->accumulator = fmod(c->accumulator, sim_step);
+  } else
+    c->accumulator -= steps * sim_step;
+  return steps;
+}
+
+/* How far the display is between the last step and the next one */
+float sim_clock_alpha(struct sim_clock const *c) {
+  return (float) (c->accumulator / sim_step);
+}
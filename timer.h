@@ -0,0 +1,24 @@
+#ifndef timer_h
+#define timer_h
+
+#define sim_step                (1.0/120.0) /* fixed simulation step (s) */
+#define sim_max_substeps        8       /* catch-up limit per frame */
+#define sim_fast_forward_steps  64      /* steps per frame in fast forward */
+
+/* Fixed-timestep simulation clock.  Wall time is accumulated and consumed in
+ * whole steps; what is left over gives the interpolation factor used when
+ * drawing. */
+struct sim_clock {
+  double last;          /* wall time of the previous frame */
+  double accumulator;   /* wall time not yet simulated */
+  int fast_forward;     /* run sim_fast_forward_steps every frame */
+};
+
+/* Monotonic wall clock in seconds */
+double timer_now(void);
+
+void sim_clock_start(struct sim_clock *);
+int sim_clock_steps(struct sim_clock *);
+float sim_clock_alpha(struct sim_clock const *);
+
+#endif /* timer_h */
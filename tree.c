@@ -0,0 +1,652 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "3dtree.h"
+#include "tree.h"
+#include "glcaps.h"
+#include "frustum.h"
+
+GLfloat tree_color[]      = {0.6, 0.4, 0.0, 1.0};
+GLfloat leaf_color[]      = {0.0, 0.5, 0.0, 1.0};
+
+#define tree_children   5
+#define leaf_size       0.2
+#define tube_radius     0.03    /* of a branch at its base, for its size */
+#define tube_taper      0.5     /* radius at the tip over that at the base */
+/* level of detail, in pixels on the screen */
+#define lod_proxy       8.0     /* subtrees smaller than this are a proxy */
+#define lod_thin        1.0     /* thinner branches are lines */
+#define lod_sides_3     4.0     /* up to this radius tubes have 3 sides */
+#define lod_sides_6     12.0    /* and up to this 6, otherwise 12 */
+/* vertices are a position and a normal */
+#define vertex_floats   6
+#define line_floats     (2 * vertex_floats)
+#define leaf_floats     (3 * vertex_floats)
+
+/* A branch of size s is s/2 long.  Below its trigger it ends in a leaf,
+ * otherwise five branches grow from its end, each half its size and with
+ * three quarters of its trigger, scaled by the factors here.  The turn is
+ * about the branch and the tilt away from it. */
+static struct tree_rule {
+  GLfloat turn, tilt, size, trigger;
+} const tree_rules[tree_children] = {
+  {  0.0, 25.0, 0.9, 0.9},
+  { 72.0, 30.0, 1.0, 0.9},
+  {144.0, 25.0, 0.9, 1.0},
+  {216.0, 30.0, 1.1, 1.1},
+  {288.0, 35.0, 1.0, 1.1}
+};
+
+/* Rotate the axes a and b of a node about the third by angle degrees, as
+ * glRotatef() would */
+static void turn_axes(GLfloat axes[9], int a, int b, GLfloat angle) {
+  GLfloat const c = cos(angle * PI/180.0), s = sin(angle * PI/180.0);
+  int i;
+
+  for(i = 0; i < 3; i++) {
+    GLfloat const u = axes[3*a+i], v = axes[3*b+i];
+    axes[3*a+i] = c*u - s*v;
+    axes[3*b+i] = s*u + c*v;
+  }
+}
+
+/* Keep the frontier heap ordered by split size */
+static void frontier_push(struct tree *t, int node) {
+  int i = t->frontier_count++, parent;
+
+  while(i > 0) {
+    parent = (i - 1) / 2;
+    if(t->nodes[t->frontier[parent]].split <= t->nodes[node].split) break;
+    t->frontier[i] = t->frontier[parent];
+    i = parent;
+  }
+  t->frontier[i] = node;
+}
+
+static int frontier_pop(struct tree *t) {
+  int const top = t->frontier[0];
+  int const last = t->frontier[--t->frontier_count];
+  int i = 0, child;
+
+  for(;;) {
+    child = 2*i + 1;
+    if(child >= t->frontier_count) break;
+    if(child + 1 < t->frontier_count &&
+       t->nodes[t->frontier[child+1]].split <
+       t->nodes[t->frontier[child]].split)
+      child++;
+    if(t->nodes[last].split <= t->nodes[t->frontier[child]].split) break;
+    t->frontier[i] = t->frontier[child];
+    i = child;
+  }
+  t->frontier[i] = last;
+  return top;
+}
+
+static void *grow_array(void *p, int n, size_t size) {
+  p = realloc(p, n * size);
+  if(!p) {
+    fprintf(stderr, "ERROR: unable to allocate %d tree nodes\n", n);
+    exit(1);
+  }
+  return p;
+}
+
+/* Grow the bounding sphere of a to take in that of b.  Returns 0 when it
+ * already did. */
+static int enclose(struct tree_node *a, struct tree_node const *b) {
+  GLfloat d[3], distance, radius;
+  int i;
+
+  for(i = 0; i < 3; i++)
+    d[i] = b->centre[i] - a->centre[i];
+  distance = sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+  if(distance + b->radius <= a->radius)
+    return 0;
+  if(distance + a->radius <= b->radius) {
+    for(i = 0; i < 3; i++)
+      a->centre[i] = b->centre[i];
+    a->radius = b->radius;
+    return 1;
+  }
+  radius = 0.5 * (distance + a->radius + b->radius);
+  for(i = 0; i < 3; i++)
+    a->centre[i] += d[i] * (radius - a->radius) / distance;
+  a->radius = radius;
+  return 1;
+}
+
+/* Add a node with a leaf, growing from the tip of parent, or the trunk
+ * when parent is -1 */
+static void add_node(struct tree *t, int parent, struct tree_rule const *rule) {
+  struct tree_node *node;
+  GLfloat const *base;
+  GLfloat const origin[3] = {0.0, 0.0, 0.0};
+  GLfloat *v;
+  int i;
+
+  if(t->node_count == t->capacity) {
+    t->capacity = t->capacity ? 2 * t->capacity : 256;
+    t->nodes = (struct tree_node *)
+      grow_array(t->nodes, t->capacity, sizeof(struct tree_node));
+    t->frontier = (int *) grow_array(t->frontier, t->capacity, sizeof(int));
+    t->lines = (GLfloat *)
+      grow_array(t->lines, t->capacity, line_floats*sizeof(GLfloat));
+    t->leaves = (GLfloat *)
+      grow_array(t->leaves, t->capacity, leaf_floats*sizeof(GLfloat));
+    t->leaf_node = (int *) grow_array(t->leaf_node, t->capacity, sizeof(int));
+    t->stack = (int *) grow_array(t->stack, t->capacity, sizeof(int));
+  }
+  node = &t->nodes[t->node_count];
+
+  if(parent < 0) {
+    /* the trunk, straight up */
+    for(i = 0; i < 9; i++)
+      node->axes[i] = (i % 4 == 0) ? 1.0 : 0.0;
+    node->size = 1.0;
+    node->split = t->trigger;
+    base = origin;
+  } else {
+    /* half the size and three quarters of the trigger, by the rule */
+    struct tree_node const *p = &t->nodes[parent];
+    for(i = 0; i < 9; i++)
+      node->axes[i] = p->axes[i];
+    turn_axes(node->axes, 0, 2, rule->turn);
+    turn_axes(node->axes, 1, 0, rule->tilt);
+    node->size = p->size * 0.5 * rule->size;
+    node->split = p->split * 1.5 * rule->trigger / rule->size;
+    base = p->tip;
+  }
+  /* lines are lit with the branch's own y axis as their normal */
+  v = &t->lines[line_floats * t->node_count];
+  for(i = 0; i < 3; i++) {
+    node->tip[i] = base[i] + 0.5 * node->size * node->axes[3+i];
+    v[i] = base[i];
+    v[vertex_floats+i] = node->tip[i];
+    v[3+i] = v[vertex_floats+3+i] = node->axes[3+i];
+  }
+
+  node->parent = parent;
+  node->children = -1;
+  node->leaf = t->leaf_count++;
+  t->leaf_node[node->leaf] = t->node_count;
+
+  /* bounds of the branch, then of everything it grows from */
+  for(i = 0; i < 3; i++)
+    node->centre[i] = 0.5 * (base[i] + node->tip[i]);
+  node->radius = 0.25 * node->size + tube_radius * node->size;
+  for(i = t->node_count; t->nodes[i].parent >= 0; i = t->nodes[i].parent)
+    if(!enclose(&t->nodes[t->nodes[i].parent], &t->nodes[i]))
+      break;
+
+  frontier_push(t, t->node_count);
+  t->node_count++;
+}
+
+/* Replace the leaf of a node with branches */
+static void split_node(struct tree *t, int n) {
+  int const last = --t->leaf_count;
+  int const leaf = t->nodes[n].leaf;
+  int i;
+
+  /* the last leaf takes the place of this one */
+  t->leaf_node[leaf] = t->leaf_node[last];
+  t->nodes[t->leaf_node[leaf]].leaf = leaf;
+  t->nodes[n].leaf = -1;
+  t->nodes[n].children = t->node_count;
+  if(t->nodes[n].split > t->grown)
+    t->grown = t->nodes[n].split;
+  t->leaves_changed = 1;
+
+  for(i = 0; i < tree_children; i++)
+    add_node(t, n, &tree_rules[i]);
+}
+
+/* Start again from a bare trunk */
+static void tree_reset(struct tree *t) {
+  t->node_count = 0;
+  t->frontier_count = 0;
+  t->leaf_count = 0;
+  t->grown = 0.0;
+  t->buffered_nodes = 0;
+  t->leaves_changed = 1;
+  t->lod_nodes = -1;
+  add_node(t, -1, NULL);
+}
+
+void tree_init(struct tree *t, GLfloat trigger) {
+  t->trigger = trigger;
+  t->size = 0.0;
+  t->nodes = NULL;
+  t->frontier = NULL;
+  t->lines = NULL;
+  t->leaves = NULL;
+  t->leaf_node = NULL;
+  t->stack = NULL;
+  t->capacity = 0;
+  memset(&t->tubes, 0, sizeof(struct tree_batch));
+  memset(&t->lines_lod, 0, sizeof(struct tree_batch));
+  memset(&t->leaves_lod, 0, sizeof(struct tree_batch));
+  t->use_buffers = -1;
+  memset(t->buffers, 0, sizeof(t->buffers));
+  t->buffer_capacity = 0;
+  tree_reset(t);
+}
+
+/* Write the leaf at the tip of a node, for a tree of the given size */
+static void put_leaf(GLfloat *v, struct tree_node const *node, GLfloat size) {
+  int j;
+
+  /* the leaves stay the same size while the tree scales */
+  for(j = 0; j < 3; j++) {
+    GLfloat const tip = size * node->tip[j];
+    v[j] = tip + leaf_size * node->axes[3+j];
+    v[vertex_floats+j] = tip + leaf_size * node->axes[j];
+    v[2*vertex_floats+j] = tip - leaf_size * node->axes[j];
+    v[3+j] = v[vertex_floats+3+j] = v[2*vertex_floats+3+j] = node->axes[3+j];
+  }
+}
+
+void tree_grow(struct tree *t, GLfloat size) {
+  /* a shrinking tree loses branches, so grow it again from the trunk */
+  if(size < t->grown)
+    tree_reset(t);
+  while(t->frontier_count > 0 && t->nodes[t->frontier[0]].split <= size)
+    split_node(t, frontier_pop(t));
+
+  /* the leaves are placed when they are next drawn */
+  if(size != t->size) {
+    t->size = size;
+    t->leaves_changed = 1;
+  }
+}
+
+/* Bring the GL copy of the lines or the leaves up to date, leaving its
+ * buffer bound.  Only lines added since the last upload are sent; the
+ * leaves move whenever the size changes, so they go as a whole. */
+static void update_buffer(struct tree *t, int leaves) {
+  glBindBuffer(GL_ARRAY_BUFFER, t->buffers[leaves]);
+  if(leaves) {
+    if(t->leaves_changed)
+      glBufferData(GL_ARRAY_BUFFER,
+                   t->leaf_count * leaf_floats * sizeof(GLfloat), t->leaves,
+                   GL_DYNAMIC_DRAW);
+    return;
+  }
+  if(t->buffer_capacity < t->capacity) {
+    glBufferData(GL_ARRAY_BUFFER, t->capacity * line_floats * sizeof(GLfloat),
+                 NULL, GL_STATIC_DRAW);
+    t->buffer_capacity = t->capacity;
+    t->buffered_nodes = 0;
+  }
+  if(t->buffered_nodes < t->node_count) {
+    GLsizeiptr const line_size = line_floats * sizeof(GLfloat);
+    glBufferSubData(GL_ARRAY_BUFFER, t->buffered_nodes * line_size,
+                    (t->node_count - t->buffered_nodes) * line_size,
+                    t->lines + line_floats * t->buffered_nodes);
+    t->buffered_nodes = t->node_count;
+  }
+}
+
+/* Whether the GL copies are kept in buffers, making them the first time */
+static int have_buffers(struct tree *t) {
+  if(t->use_buffers < 0) {
+    t->use_buffers = gl_version_at_least(1, 5) ||
+                     gl_has_extension("GL_ARB_vertex_buffer_object");
+    if(t->use_buffers)
+      glGenBuffers(4, t->buffers);
+  }
+  return t->use_buffers;
+}
+
+/* Make the GL copies current and point the arrays at the lines or the
+ * leaves.  Returns the vertices to draw. */
+static int set_arrays(struct tree *t, int leaves) {
+  GLfloat const *vertices = leaves ? t->leaves : t->lines;
+
+  have_buffers(t);
+  if(leaves && t->leaves_changed) {
+    int i;
+    for(i = 0; i < t->leaf_count; i++)
+      put_leaf(&t->leaves[leaf_floats * i], &t->nodes[t->leaf_node[i]],
+               t->size);
+  }
+  if(t->use_buffers) {
+    update_buffer(t, leaves);
+    vertices = NULL;
+  }
+  if(leaves)
+    t->leaves_changed = 0;
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_NORMAL_ARRAY);
+  glVertexPointer(3, GL_FLOAT, vertex_floats * sizeof(GLfloat), vertices);
+  glNormalPointer(GL_FLOAT, vertex_floats * sizeof(GLfloat), vertices + 3);
+  return leaves ? 3 * t->leaf_count : 2 * t->node_count;
+}
+
+static void reset_arrays(struct tree *t) {
+  if(t->use_buffers) glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glDisableClientState(GL_NORMAL_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+void tree_draw_branches(struct tree *t, GLint scale, int instances) {
+  int vertices;
+
+  if(t->size <= 0.0) return;
+  vertices = set_arrays(t, 0);
+  if(instances) {
+    glUniform1f(scale, t->size);
+    glDrawArraysInstanced(GL_LINES, 0, vertices, instances);
+  } else {
+    /* scaled up from size 1, keeping the lighting of unscaled branches */
+    glPushMatrix();
+      glScalef(t->size, t->size, t->size);
+      glEnable(GL_NORMALIZE);
+      glDrawArrays(GL_LINES, 0, vertices);
+      glDisable(GL_NORMALIZE);
+    glPopMatrix();
+  }
+  reset_arrays(t);
+}
+
+void tree_draw_leaves(struct tree *t, GLint scale, int instances) {
+  int const vertices = set_arrays(t, 1);
+
+  /* already placed for the size */
+  if(instances) {
+    glUniform1f(scale, 1.0);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, vertices, instances);
+  } else {
+    glDrawArrays(GL_TRIANGLES, 0, vertices);
+  }
+  reset_arrays(t);
+}
+
+/* Room for n more vertices and m more indices in a batch */
+static void batch_reserve(struct tree_batch *b, int n, int m) {
+  if(b->vertex_count + n > b->vertex_capacity) {
+    b->vertex_capacity = 2 * (b->vertex_count + n);
+    b->vertices = (GLfloat *) grow_array(b->vertices, b->vertex_capacity,
+                                         vertex_floats * sizeof(GLfloat));
+  }
+  if(b->index_count + m > b->index_capacity) {
+    b->index_capacity = 2 * (b->index_count + m);
+    b->indices = (GLuint *) grow_array(b->indices, b->index_capacity,
+                                       sizeof(GLuint));
+  }
+}
+
+static void batch_free(struct tree_batch *b) {
+  free(b->vertices);
+  free(b->indices);
+  memset(b, 0, sizeof(struct tree_batch));
+}
+
+/* A vertex at size times p, with normal n */
+static void put_vertex(struct tree_batch *b, GLfloat size, GLfloat const *p,
+                       GLfloat const *n) {
+  GLfloat * const v = &b->vertices[vertex_floats * b->vertex_count++];
+
+  v[0] = size * p[0];
+  v[1] = size * p[1];
+  v[2] = size * p[2];
+  v[3] = n[0];
+  v[4] = n[1];
+  v[5] = n[2];
+}
+
+/* The branch of node n as a line */
+static void lod_line(struct tree *t, int n) {
+  GLfloat const * const line = &t->lines[line_floats * n];
+
+  batch_reserve(&t->lines_lod, 2, 0);
+  put_vertex(&t->lines_lod, t->size, line, line + 3);
+  put_vertex(&t->lines_lod, t->size, line + vertex_floats, line + 3);
+}
+
+/* The branch of node n as a tube with the given number of sides */
+static void lod_tube(struct tree *t, int n, int sides) {
+  struct tree_node const * const node = &t->nodes[n];
+  GLfloat const * const base = &t->lines[line_floats * n];
+  GLfloat const r = tube_radius * node->size;
+  struct tree_batch * const b = &t->tubes;
+  GLuint const first = b->vertex_count;
+  GLfloat normal[3], p[3];
+  int i, j;
+
+  batch_reserve(b, 2 * sides, 6 * sides);
+  for(i = 0; i < sides; i++) {
+    GLfloat const c = cos(2 * PI * i / sides), s = sin(2 * PI * i / sides);
+
+    /* round the branch, in the plane of its x and z axes */
+    for(j = 0; j < 3; j++)
+      normal[j] = c * node->axes[j] + s * node->axes[6+j];
+    for(j = 0; j < 3; j++)
+      p[j] = base[j] + r * normal[j];
+    put_vertex(b, t->size, p, normal);
+    for(j = 0; j < 3; j++)
+      p[j] = node->tip[j] + tube_taper * r * normal[j];
+    put_vertex(b, t->size, p, normal);
+  }
+  for(i = 0; i < sides; i++) {
+    GLuint const a = first + 2*i, c = first + 2*((i + 1) % sides);
+    b->indices[b->index_count++] = a;
+    b->indices[b->index_count++] = c;
+    b->indices[b->index_count++] = a + 1;
+    b->indices[b->index_count++] = a + 1;
+    b->indices[b->index_count++] = c;
+    b->indices[b->index_count++] = c + 1;
+  }
+}
+
+/* The leaves of a subtree as a square facing the viewer, half the size of
+ * its bounds.  The rows of the modelview matrix are the viewer's axes. */
+static void lod_cluster(struct tree *t, struct tree_node const *node,
+                        GLfloat const modelview[16]) {
+  GLfloat const h = 0.5 * node->radius;
+  GLfloat const normal[3] = {modelview[2], modelview[6], modelview[10]};
+  GLfloat corners[4][3];
+  int i;
+
+  for(i = 0; i < 3; i++) {
+    GLfloat const right = h * modelview[4*i], up = h * modelview[4*i+1];
+    corners[0][i] = node->centre[i] - right - up;
+    corners[1][i] = node->centre[i] + right - up;
+    corners[2][i] = node->centre[i] + right + up;
+    corners[3][i] = node->centre[i] - right + up;
+  }
+  batch_reserve(&t->leaves_lod, 6, 0);
+  put_vertex(&t->leaves_lod, t->size, corners[0], normal);
+  put_vertex(&t->leaves_lod, t->size, corners[1], normal);
+  put_vertex(&t->leaves_lod, t->size, corners[2], normal);
+  put_vertex(&t->leaves_lod, t->size, corners[0], normal);
+  put_vertex(&t->leaves_lod, t->size, corners[2], normal);
+  put_vertex(&t->leaves_lod, t->size, corners[3], normal);
+}
+
+/* Distance from the viewer to size times p */
+static GLfloat view_distance(GLfloat const m[16], GLfloat size,
+                             GLfloat const *p) {
+  GLfloat e[3];
+  int i;
+
+  for(i = 0; i < 3; i++)
+    e[i] = size * (m[i]*p[0] + m[4+i]*p[1] + m[8+i]*p[2]) + m[12+i];
+  return sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
+}
+
+void tree_select_lod(struct tree *t, GLfloat const modelview[16],
+                     GLfloat const projection[16], int height) {
+  /* pixels covered by a unit at unit distance */
+  GLfloat const scale = 0.5 * height * projection[5];
+  GLfloat const size = t->size;
+  struct frustum view;
+  int top = 0;
+
+  frustum_from_matrices(&view, modelview, projection);
+  t->tubes.vertex_count = t->tubes.index_count = 0;
+  t->lines_lod.vertex_count = 0;
+  t->leaves_lod.vertex_count = 0;
+
+  /* down from the trunk, stopping where a subtree is small enough */
+  t->stack[top++] = 0;
+  while(top > 0) {
+    int const n = t->stack[--top];
+    struct tree_node const * const node = &t->nodes[n];
+    GLfloat const d = view_distance(modelview, size, node->centre);
+    /* the leaves keep their size however small the tree */
+    GLfloat const r = size * node->radius + leaf_size;
+    GLfloat centre[3], pixels;
+
+    /* nothing of the subtree is in view */
+    centre[0] = size * node->centre[0];
+    centre[1] = size * node->centre[1];
+    centre[2] = size * node->centre[2];
+    if(!frustum_sphere(&view, centre, r))
+      continue;
+
+    if(node->children >= 0 && d > r && scale * r / d < lod_proxy) {
+      lod_line(t, n);
+      lod_cluster(t, node, modelview);
+      continue;
+    }
+
+    /* thickness of the branch itself on the screen */
+    pixels = (d > r) ? scale * size * tube_radius * node->size / d
+                     : lod_sides_6;
+    if(pixels < lod_thin)
+      lod_line(t, n);
+    else
+      lod_tube(t, n, (pixels < lod_sides_3) ? 3
+                     : (pixels < lod_sides_6) ? 6 : 12);
+
+    if(node->children < 0) {
+      batch_reserve(&t->leaves_lod, 3, 0);
+      put_leaf(t->leaves_lod.vertices +
+               vertex_floats * t->leaves_lod.vertex_count, node, size);
+      t->leaves_lod.vertex_count += 3;
+    } else {
+      int i;
+      for(i = 0; i < tree_children; i++)
+        t->stack[top++] = node->children + i;
+    }
+  }
+}
+
+/* Whether what was last picked still holds for the tree and the view */
+static int lod_kept(struct tree const *t, GLfloat const modelview[16],
+                    GLfloat const projection[16], int height) {
+  return t->lod_nodes == t->node_count && t->lod_size == t->size &&
+         t->lod_height == height &&
+         memcmp(t->lod_modelview, modelview, sizeof(t->lod_modelview)) == 0 &&
+         memcmp(t->lod_projection, projection, sizeof(t->lod_projection)) == 0;
+}
+
+/* Copy what was picked into the GL buffers, the tubes first so that their
+ * indices need no offset, then the lines and the leaves */
+static void upload_lod(struct tree *t) {
+  GLsizeiptr const vertex_size = vertex_floats * sizeof(GLfloat);
+  GLsizeiptr const tubes = t->tubes.vertex_count * vertex_size;
+  GLsizeiptr const lines = t->lines_lod.vertex_count * vertex_size;
+  GLsizeiptr const leaves = t->leaves_lod.vertex_count * vertex_size;
+
+  glBindBuffer(GL_ARRAY_BUFFER, t->buffers[2]);
+  glBufferData(GL_ARRAY_BUFFER, tubes + lines + leaves, NULL,
+               GL_DYNAMIC_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, tubes, t->tubes.vertices);
+  glBufferSubData(GL_ARRAY_BUFFER, tubes, lines, t->lines_lod.vertices);
+  glBufferSubData(GL_ARRAY_BUFFER, tubes + lines, leaves,
+                  t->leaves_lod.vertices);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, t->buffers[3]);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, t->tubes.index_count * sizeof(GLuint),
+               t->tubes.indices, GL_DYNAMIC_DRAW);
+}
+
+/* Draw a batch whose vertices start at vertices, and indices, if it has
+ * any, at indices; these are offsets into the bound buffers when there
+ * are buffers */
+static void draw_batch(struct tree_batch const *b, GLenum mode,
+                       GLfloat const *vertices, GLuint const *indices) {
+  if(b->vertex_count == 0) return;
+  glVertexPointer(3, GL_FLOAT, vertex_floats * sizeof(GLfloat), vertices);
+  glNormalPointer(GL_FLOAT, vertex_floats * sizeof(GLfloat), vertices + 3);
+  if(b->index_count > 0)
+    glDrawElements(mode, b->index_count, GL_UNSIGNED_INT, indices);
+  else
+    glDrawArrays(mode, 0, b->vertex_count);
+}
+
+void tree_draw_lod(struct tree *t) {
+  GLfloat modelview[16], projection[16];
+  GLint viewport[4];
+  GLfloat const *tubes, *lines, *leaves;
+  GLuint const *indices;
+
+  glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+  glGetFloatv(GL_PROJECTION_MATRIX, projection);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  if(!lod_kept(t, modelview, projection, viewport[3])) {
+    tree_select_lod(t, modelview, projection, viewport[3]);
+    memcpy(t->lod_modelview, modelview, sizeof(t->lod_modelview));
+    memcpy(t->lod_projection, projection, sizeof(t->lod_projection));
+    t->lod_size = t->size;
+    t->lod_height = viewport[3];
+    t->lod_nodes = t->node_count;
+    if(have_buffers(t))
+      upload_lod(t);
+  } else if(t->use_buffers) {
+    glBindBuffer(GL_ARRAY_BUFFER, t->buffers[2]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, t->buffers[3]);
+  }
+
+  if(t->use_buffers) {
+    tubes = NULL;
+    lines = tubes + vertex_floats * t->tubes.vertex_count;
+    leaves = lines + vertex_floats * t->lines_lod.vertex_count;
+    indices = NULL;
+  } else {
+    tubes = t->tubes.vertices;
+    lines = t->lines_lod.vertices;
+    leaves = t->leaves_lod.vertices;
+    indices = t->tubes.indices;
+  }
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_NORMAL_ARRAY);
+  glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, tree_color);
+  draw_batch(&t->tubes, GL_TRIANGLES, tubes, indices);
+  draw_batch(&t->lines_lod, GL_LINES, lines, NULL);
+  glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, leaf_color);
+  draw_batch(&t->leaves_lod, GL_TRIANGLES, leaves, NULL);
+  glDisableClientState(GL_NORMAL_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  if(t->use_buffers) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+}
+
+void tree_free(struct tree *t) {
+  if(t->use_buffers > 0)
+    glDeleteBuffers(4, t->buffers);
+  free(t->nodes);
+  free(t->frontier);
+  free(t->lines);
+  free(t->leaves);
+  free(t->leaf_node);
+  free(t->stack);
+  batch_free(&t->tubes);
+  batch_free(&t->lines_lod);
+  batch_free(&t->leaves_lod);
+  t->nodes = NULL;
+  t->frontier = NULL;
+  t->lines = t->leaves = NULL;
+  t->leaf_node = NULL;
+  t->stack = NULL;
+  t->node_count = t->leaf_count = t->frontier_count = t->capacity = 0;
+}
@@ -0,0 +1,87 @@
+#ifndef tree_h
+#define tree_h
+
+#include <GL/gl.h>
+
+extern GLfloat tree_color[];
+extern GLfloat leaf_color[];
+
+/* A branch of a grown tree.  Positions are for a tree of size 1; the whole
+ * tree scales with its size, except for the leaves. */
+struct tree_node {
+  GLfloat tip[3];         /* end of the branch */
+  GLfloat axes[9];        /* the branch's x, y and z axes */
+  GLfloat size;           /* size relative to the trunk */
+  GLfloat split;          /* tree size at which it grows more branches */
+  int leaf;               /* its leaf, or -1 once it has branches */
+  int parent;             /* -1 for the trunk */
+  int children;           /* first of its branches, or -1 */
+  GLfloat centre[3];      /* bounding sphere of the branch and all that */
+  GLfloat radius;         /* grows from it */
+};
+
+/* Vertices with normals, and optionally indices, collected for one draw */
+struct tree_batch {
+  GLfloat *vertices;
+  GLuint *indices;
+  int vertex_count, vertex_capacity;
+  int index_count, index_capacity;
+};
+
+/* A tree kept between frames.  Branches are only added when the size
+ * passes their split size, so growing a little costs a few nodes rather
+ * than the whole tree. */
+struct tree {
+  GLfloat trigger;        /* size at which the trunk branches */
+  GLfloat size;           /* size the tree is grown to */
+  GLfloat grown;          /* largest split size passed */
+  struct tree_node *nodes;
+  int node_count, capacity;
+  int *frontier;          /* heap of the nodes with leaves, by split size */
+  int frontier_count;
+  GLfloat *lines;         /* two vertices per node, for size 1 */
+  GLfloat *leaves;        /* three vertices per leaf, placed for size */
+  int *leaf_node;         /* node each leaf belongs to */
+  int leaf_count;
+  /* copies in GL buffers, when the GL has them */
+  int use_buffers;        /* 1 with buffers, 0 without, -1 not yet known */
+  GLuint buffers[4];      /* lines, leaves, and the level of detail's
+                             vertices and indices */
+  int buffered_nodes;     /* lines already in the buffer */
+  int buffer_capacity;    /* nodes the lines buffer has room for */
+  int leaves_changed;     /* leaves need placing and uploading */
+  /* what tree_select_lod() picked for the view */
+  struct tree_batch tubes, lines_lod, leaves_lod;
+  /* what tree_draw_lod() last picked it for, kept while that holds */
+  GLfloat lod_modelview[16], lod_projection[16];
+  GLfloat lod_size;
+  int lod_height;
+  int lod_nodes;          /* -1 when there is nothing kept */
+  int *stack;
+};
+
+/* Trees grown by the rules in tree.c.  tree_grow() needs no GL context. */
+void tree_init(struct tree *, GLfloat trigger);
+void tree_grow(struct tree *, GLfloat size);
+/* Either batch on its own, in the current material, so that many trees
+ * can share one material setup.  With instances 0 the tree is drawn once;
+ * otherwise that many copies are drawn with glDrawArraysInstanced(), and
+ * the caller binds a program, which scales the branch vertices by its
+ * uniform at scale, and sets up the per-instance attributes. */
+void tree_draw_branches(struct tree *, GLint scale, int instances);
+void tree_draw_leaves(struct tree *, GLint scale, int instances);
+/* Level of detail: branches as tapered tubes, with fewer sides as they get
+ * smaller on the screen, or as lines once they are thinner than a pixel.
+ * Subtrees only a few pixels across are drawn as a proxy, their branch as
+ * a line and their leaves as one square facing the viewer, and subtrees
+ * out of view are left out.
+ * tree_select_lod() picks the geometry for a view given by the modelview
+ * and projection matrices and the viewport height; tree_draw_lod() does
+ * so for the current GL matrices and draws it, keeping what it picked in
+ * GL buffers until the tree grows or the view changes. */
+void tree_select_lod(struct tree *, GLfloat const modelview[16],
+                     GLfloat const projection[16], int height);
+void tree_draw_lod(struct tree *);
+void tree_free(struct tree *);
+
+#endif /* tree_h */
@@ -0,0 +1,377 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "3dtree.h"
+#include "water.h"
+#include "water_kernel.h"
+#include "pool.h"
+#include "sph.h"
+#include "rng.h"
+#include "arena.h"
+
+/* Tunables */
+int water_particles = 20000;
+GLfloat water_released = 2000;
+GLfloat water_particle_size = 4.0;
+GLfloat gravity = 100.0;
+
+/* Variables */
+GLfloat container_water_level = container_height - 1.0;
+GLfloat tray_water_level = 0.0;
+GLfloat tray_water_particle_volume;
+GLfloat door_frame[3][3];
+GLfloat doory = 0.0;
+struct particles water;
+int water_interact = 0;
+static unsigned char *hits;   /* hit mask written by the kernel */
+static long refused;          /* particles not released for want of room */
+static int refused_steps;     /* steps when that happened */
+
+/* Smallest share of the particles worth handing to another thread */
+#define particles_per_worker    2048
+
+/* A worker's share of a step.  Each worker owns the particles [begin, end)
+ * and keeps its own count of tray hits and restarts; these are merged into
+ * the shared water levels once every worker has finished. */
+struct water_worker {
+  int begin, end;
+  int hits;               /* particles that reached the tray */
+  int budget;             /* particles this worker may restart */
+  int released;           /* particles restarted */
+  int live;               /* live particles left at the front of the range */
+  struct rng rng;         /* the worker's own random numbers */
+};
+
+/* Chute geometry, fixed once the door frame is known */
+struct chute {
+  GLfloat h, l, mag_hl;   /* drop, horizontal length and length of chute */
+  GLfloat acc;            /* acceleration along the chute */
+  GLfloat end;            /* z of the end of the chute */
+  GLfloat dia;            /* particle diameter */
+  GLfloat x0, x_range;    /* where particles can start across the door */
+};
+
+static struct chute chute;
+static struct sph_bounds sph_bounds;
+
+static struct water_worker *workers;
+static struct water_step step;
+static GLfloat step_wh;       /* water height in the container for the step */
+static GLfloat release_carry; /* part of a particle owed by earlier steps */
+
+void particles_init(struct particles *p, int capacity) {
+  /* each array is a whole number of chunks */
+  size_t const chunks = (capacity + particle_chunk - 1) / particle_chunk;
+  size_t const size = chunks * particle_chunk * sizeof(GLfloat);
+  GLfloat *arena = (GLfloat *) arena_reserve(6 * size);
+
+  if(!arena) {
+    fprintf(stderr, "ERROR: unable to set aside %d water particles\n",
+            capacity);
+    exit(1);
+  }
+  p->arena = arena;
+  p->arena_size = 6 * size;
+  p->x = arena;
+  p->y = p->x + size / sizeof(GLfloat);
+  p->z = p->y + size / sizeof(GLfloat);
+  p->vx = p->z + size / sizeof(GLfloat);
+  p->vy = p->vx + size / sizeof(GLfloat);
+  p->vz = p->vy + size / sizeof(GLfloat);
+  p->count = 0;
+  p->capacity = capacity;
+  p->chunks = 0;
+  p->peak = 0;
+}
+
+/* Copy particle src into slot dst */
+void particles_move(struct particles *p, int dst, int src) {
+  p->x[dst] = p->x[src];
+  p->y[dst] = p->y[src];
+  p->z[dst] = p->z[src];
+  p->vx[dst] = p->vx[src];
+  p->vy[dst] = p->vy[src];
+  p->vz[dst] = p->vz[src];
+}
+
+/* Note how far the live particles reach, and give back the memory of the
+ * chunks above them but one, which is kept so that a flow holding steady
+ * at a chunk boundary does not hand the same chunk back and forth */
+void particles_trim(struct particles *p) {
+  int const used = (p->count + particle_chunk - 1) / particle_chunk;
+  size_t first, size;
+
+  if(p->count > p->peak) p->peak = p->count;
+  if(used > p->chunks) p->chunks = used;
+  if(p->chunks <= used + 1) return;
+
+  first = (size_t) (used + 1) * particle_chunk;
+  size = (p->chunks - used - 1) * particle_chunk * sizeof(GLfloat);
+  arena_release(p->x + first, size);
+  arena_release(p->y + first, size);
+  arena_release(p->z + first, size);
+  arena_release(p->vx + first, size);
+  arena_release(p->vy + first, size);
+  arena_release(p->vz + first, size);
+  p->chunks = used + 1;
+}
+
+size_t particles_memory(struct particles const *p) {
+  return (size_t) p->chunks * particle_chunk * 6 * sizeof(GLfloat);
+}
+
+void init_door_frame() {
+  GLfloat doorz, door_half_width, door_frame_height;
+
+  doorz = container_radius * cos(PI/6);
+  door_half_width = 0.5 * container_radius * sin(PI/6);
+  door_frame[0][0] = -door_half_width;
+  door_frame[0][1] = door_height;
+  door_frame[0][2] = doorz;
+  door_frame[1][0] = door_half_width;
+  door_frame[1][1] = door_height;
+  door_frame[1][2] = doorz;
+  door_frame[2][0] = 0.0;
+  door_frame_height = sqrt((2*door_half_width)*(2*door_half_width) - 
+                           door_half_width*door_half_width);
+  door_frame[2][1] = door_height + door_frame_height;
+  door_frame[2][2] = doorz;
+}
+
+void init_water(int capacity, int threads, unsigned long seed) {
+  int w;
+
+  tray_water_particle_volume = 1 * water_particle_volume / 
+    (container_water_level - door_frame[0][1]);
+
+  /* drop of chute */
+  chute.h = door_frame[0][1] - 2.0;
+  /* horizontal length of chute */
+  chute.l = chute_length;
+  /* length of chute */
+  chute.mag_hl = sqrt(chute.h*chute.h + chute.l*chute.l);
+  chute.acc = gravity*chute.h*cos(atan(chute.l/chute.h));
+  chute.end = chute_length+door_frame[0][2];
+  /* diameter of particles */
+  chute.dia = water_particle_size/25.0;
+  chute.x0 = door_frame[0][0] + chute.dia/2;
+  chute.x_range = door_frame[1][0] - door_frame[0][0] - chute.dia;
+
+  particles_init(&water, capacity);
+  hits = (unsigned char *) malloc((capacity + 7) / 8);
+  if(!hits) {
+    fprintf(stderr, "ERROR: unable to allocate the water hit mask\n");
+    exit(1);
+  }
+  init_water_kernel();
+
+  init_pool(threads);
+  workers = (struct water_worker *) 
+    malloc(pool_threads * sizeof(struct water_worker));
+  if(!workers) {
+    fprintf(stderr, "ERROR: unable to allocate the water workers\n");
+    exit(1);
+  }
+  for(w = 0; w < pool_threads; w++)
+    rng_seed(&workers[w].rng, seed + w);
+
+  /* the particles are kept on the chute's surface, between its sides */
+  sph_bounds.end_of_chute = chute.end;
+  sph_bounds.normal[0] = 0.0;
+  sph_bounds.normal[1] = chute.l / chute.mag_hl;
+  sph_bounds.normal[2] = chute.h / chute.mag_hl;
+  sph_bounds.x_min = chute.x0;
+  sph_bounds.x_max = chute.x0 + chute.x_range;
+  if(water_interact)
+    init_sph(capacity);
+}
+
+/* Start n particles in slots [first, first+n) at the door.  wh is the
+ * height of the water above the bottom of the door frame; the caller
+ * accounts for the volume released. */
+void emit_particles(struct particles *p, int first, int n, GLfloat wh,
+                    struct rng *r) {
+  /* spread of starting heights and speeds for this water level */
+  GLfloat const y_range = ((wh > 0.5) ? doory : wh) - chute.dia;
+  GLfloat const y0 = door_frame[0][1] + chute.dia;
+  GLfloat const z0 = door_frame[0][2];
+  GLfloat const vy = -water_start_velocity*wh*chute.h/chute.mag_hl;
+  GLfloat const vz = +water_start_velocity*wh*chute.l/chute.mag_hl;
+  register int i;
+
+  for(i = first; i < first + n; i++) {
+    GLfloat const speed = 1.0 + rng_float(r);
+
+    /* position */
+    p->x[i] = chute.x0 + rng_float(r)*chute.x_range;
+    p->y[i] = y0 + rng_float(r)*y_range;
+    p->z[i] = z0;
+
+    /* velocity */
+    p->vx[i] = 0.0;
+    p->vy[i] = speed*vy;
+    p->vz[i] = speed*vz;
+  }
+}
+
+/* Move a worker's particles and flag those reaching the tray */
+static void integrate_range(void *arg, int w) {
+  struct water_worker * const ww = &workers[w];
+
+  ww->hits = water_kernel(&step, &water, ww->begin, ww->end,
+                          hits + ww->begin / 8);
+}
+
+/* Restart or deactivate a worker's particles that reached the tray.  Removed
+ * particles are replaced by the last live particle of the same range, so the
+ * range stays packed at the front without touching other workers. */
+static void settle_range(void *arg, int w) {
+  struct water_worker * const ww = &workers[w];
+  unsigned char const * const mask = hits + ww->begin / 8;
+  register int i;
+  int b;
+
+  ww->released = 0;
+  ww->live = ww->end - ww->begin;
+  if(ww->hits == 0) return;
+
+  /* top down, so a removal only moves an already handled particle */
+  for(b = (ww->end - ww->begin + 7) / 8 - 1; b >= 0; b--) {
+    if(!mask[b]) continue;
+    for(i = b * 8 + 7; i >= b * 8; i--) {
+      if(!(mask[b] & (1 << (i & 7)))) continue;
+      if(ww->released < ww->budget) {
+        /* restart particle */
+        emit_particles(&water, ww->begin + i, 1, step_wh, &ww->rng);
+        ww->released++;
+      } else {
+        /* deactivate particle */
+        ww->live--;
+        particles_move(&water, ww->begin + i, ww->begin + ww->live);
+      }
+    }
+  }
+}
+
+/* Close the gaps left at the end of each worker's range by moving the
+ * highest live particles down into them. */
+static void compact_ranges(int n, int count) {
+  int hw = 0, hole = workers[0].begin + workers[0].live;
+  int sw = n - 1, src = workers[n-1].begin + workers[n-1].live - 1;
+
+  for(;;) {
+    /* next hole below the new count */
+    while(hw < n && hole >= workers[hw].end)
+      if(++hw < n) hole = workers[hw].begin + workers[hw].live;
+    if(hw == n || hole >= count) break;
+    /* next live particle above it */
+    while(src < workers[sw].begin) {
+      sw--;
+      src = workers[sw].begin + workers[sw].live - 1;
+    }
+    particles_move(&water, hole++, src--);
+  }
+}
+
+void calculate_water(float elapsed) {
+  int w, n, share, batch;
+  int total_hits = 0, released = 0, live = 0, budget;
+  GLfloat max_release;
+
+  /* compute values once */
+  step.elapsed = elapsed;
+  step.end_of_chute = chute.end;
+  step.y_acceleration = gravity * elapsed;
+  step.vert_acc = elapsed*chute.acc*chute.h/chute.mag_hl;
+  step.horiz_acc = elapsed*chute.acc*chute.l/chute.mag_hl;
+  /* water height above bottom of door frame */
+  step_wh =  container_water_level-door_frame[0][1];
+  /* number of particles to release this time */
+  max_release = elapsed * water_released/0.5 * 
+                ((step_wh > 0.5) ? doory : step_wh);
+  step.dia = chute.dia;
+
+  /* releases allowed this step, limited by the water left above the door.
+   * The part of a particle left over is carried to the next step, so that
+   * the rate does not depend on the step length. */
+  budget = 0;
+  if(step_wh > 0.0 && max_release > 0.0) {
+    budget = (int) floor(max_release + release_carry);
+    release_carry += max_release - budget;
+    if(budget > ceil(step_wh / water_particle_volume)) {
+      budget = (int) ceil(step_wh / water_particle_volume);
+      release_carry = 0.0;
+    }
+  } else
+    release_carry = 0.0;
+
+  /* split the live particles into 16 particle aligned ranges, so that hit
+   * mask bytes and cache lines are never shared between workers */
+  n = (water.count + particles_per_worker - 1) / particles_per_worker;
+  if(n > pool_threads) n = pool_threads;
+  if(n < 1) n = 1;
+  share = ((water.count + n - 1) / n + 15) & ~15;
+  for(w = 0; w < n; w++) {
+    workers[w].begin = (w * share < water.count) ? w * share : water.count;
+    workers[w].end = (workers[w].begin + share < water.count) ? 
+                     workers[w].begin + share : water.count;
+  }
+
+  /* push the particles apart, before the kernel moves them */
+  if(water_interact)
+    sph_step(&water, &sph_bounds, elapsed);
+
+  /* move every live particle; those reaching the tray are flagged */
+  pool_run(integrate_range, NULL, n);
+
+  /* hand out the release budget in particle order, as a single pass would */
+  for(w = 0; w < n; w++) {
+    workers[w].budget = (workers[w].hits < budget - released) ? 
+                        workers[w].hits : budget - released;
+    released += workers[w].budget;
+    total_hits += workers[w].hits;
+  }
+  if(total_hits > 0) {
+    pool_run(settle_range, NULL, n);
+    for(w = 0; w < n; w++)
+      live += workers[w].live;
+    if(live < water.count) {
+      compact_ranges(n, live);
+      water.count = live;
+    }
+  }
+
+  /* release the rest of the budget as one batch into the free slots */
+  batch = budget - released;
+  if(batch > water.capacity - water.count) {
+    /* the water stays in the container, to be released once there is room */
+    if(refused_steps++ == 0)
+      fprintf(stderr, "WARNING: room for only %d water particles, some "
+              "water is held back\n", water.capacity);
+    refused += batch - (water.capacity - water.count);
+    batch = water.capacity - water.count;
+  }
+  if(batch > 0) {
+    emit_particles(&water, water.count, batch, step_wh, &workers[0].rng);
+    water.count += batch;
+    released += batch;
+  }
+
+  /* merge the volume changes */
+  tray_water_level += total_hits * tray_water_particle_volume;
+  container_water_level -= released * water_particle_volume;
+
+  particles_trim(&water);
+  return;
+}
+
+void water_report(FILE *f) {
+  fprintf(f, "water: at most %d of %d particles, %d now in %lu KiB\n",
+          water.peak, water.capacity, water.count,
+          (unsigned long) (particles_memory(&water) / 1024));
+  if(refused > 0)
+    fprintf(f, "water: %ld particles held back over %d steps for want of "
+            "room\n", refused, refused_steps);
+}
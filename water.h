@@ -0,0 +1,61 @@
+#ifndef water_h
+#define water_h
+
+#include <stdio.h>
+#include <GL/gl.h>
+#include "rng.h"
+
+#define water_particle_volume   0.0002  /* volume of each water particle */
+#define water_start_velocity    1.0     /* pressure in tank */
+#define particle_chunk          4096    /* slots of the store a chunk holds */
+
+/* Particle store.  Positions and velocities are held in separate arrays and
+ * the live particles are packed into [0, count), so the update and draw loops
+ * only touch live particles.  The free slots are the tail [count, capacity);
+ * a particle is removed by moving the last live particle into its slot.
+ *
+ * The arrays are laid out at full capacity in an arena (see arena.h), so
+ * they never move, but they take memory a chunk of particle_chunk slots at
+ * a time as the particles reach them.  particles_trim() gives the chunks
+ * above the live particles back when the flow dies down. */
+struct particles {
+  GLfloat *x, *y, *z;     /* position */
+  GLfloat *vx, *vy, *vz;  /* velocity */
+  int count;              /* number of live particles */
+  int capacity;           /* number of slots */
+  int chunks;             /* chunks that may be holding memory */
+  int peak;               /* most live particles seen by particles_trim() */
+  void *arena;            /* where the arrays were laid out, and its size */
+  size_t arena_size;
+};
+
+/* Tunables, see config.h */
+extern int water_particles;             /* most water particles */
+extern GLfloat water_released;          /* max particles released per second */
+extern GLfloat water_particle_size;     /* size of water particles */
+extern GLfloat gravity;
+
+/* Simulation state */
+extern GLfloat container_water_level;
+extern GLfloat tray_water_level;
+extern GLfloat tray_water_particle_volume;
+extern GLfloat door_frame[3][3];
+extern GLfloat doory;
+extern struct particles water;
+extern int water_interact;      /* particles push each other, see sph.h */
+
+void particles_init(struct particles *, int);
+void particles_move(struct particles *, int, int);
+void particles_trim(struct particles *);
+/* Bytes of memory the store may be holding */
+size_t particles_memory(struct particles const *);
+
+void init_door_frame(void);
+/* Sets up the interaction too, when water_interact is already set */
+void init_water(int, int, unsigned long);
+void emit_particles(struct particles *, int, int, GLfloat, struct rng *);
+void calculate_water(float);
+/* How full the store has been, and what was not released for want of room */
+void water_report(FILE *);
+
+#endif /* water_h */
@@ -0,0 +1,170 @@
+/* vi:set sw=2 ts=2 et: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "water_kernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WATER_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+water_kernel_fn water_kernel = water_kernel_scalar;
+char const * water_kernel_name = "scalar";
+
+int water_kernel_scalar(struct water_step const *s, struct particles *p,
+                        int begin, int end, unsigned char *hits) {
+  register int i;
+  int hit_count = 0;
+
+  memset(hits, 0, (end - begin + 7) / 8);
+  for(i = begin; i < end; i++) {
+    if(p->z[i] > s->end_of_chute) {
+      /* fallen off the chute */
+      p->vy[i] -= s->y_acceleration;
+      p->y[i] += p->vy[i] * s->elapsed;
+      p->z[i] += p->vz[i] * s->elapsed;
+      if(p->y[i] <= s->dia) {
+        hits[(i - begin) >> 3] |= 1 << ((i - begin) & 7);
+        hit_count++;
+      }
+    } else {
+      /* on the chute */
+      p->z[i] += p->vz[i] * s->elapsed;
+      p->y[i] += p->vy[i] * s->elapsed;
+      p->vz[i] += s->horiz_acc;
+      p->vy[i] -= s->vert_acc;
+    }
+  }
+  return hit_count;
+}
+
+#ifdef WATER_KERNEL_X86
+
+/* The vector kernels apply both phases to every lane and select between them
+ * with the "off the chute" mask:
+ *   vy' = vy - (off ? y_acceleration : 0)
+ *   y  += vy' * elapsed,  z += vz * elapsed
+ *   vy' -= (off ? 0 : vert_acc),  vz += (off ? 0 : horiz_acc)
+ * which gives the same result as the branches in the scalar kernel. */
+
+__attribute__((target("avx2,fma")))
+static int water_kernel_avx2(struct water_step const *s, struct particles *p,
+                             int begin, int end, unsigned char *hits) {
+  __m256 const dt = _mm256_set1_ps(s->elapsed);
+  __m256 const eoc = _mm256_set1_ps(s->end_of_chute);
+  __m256 const yacc = _mm256_set1_ps(s->y_acceleration);
+  __m256 const vacc = _mm256_set1_ps(s->vert_acc);
+  __m256 const hacc = _mm256_set1_ps(s->horiz_acc);
+  __m256 const dia = _mm256_set1_ps(s->dia);
+  int i, hit_count = 0;
+
+  for(i = begin; i + 8 <= end; i += 8) {
+    __m256 y = _mm256_loadu_ps(p->y + i);
+    __m256 z = _mm256_loadu_ps(p->z + i);
+    __m256 vy = _mm256_loadu_ps(p->vy + i);
+    __m256 vz = _mm256_loadu_ps(p->vz + i);
+    __m256 const off = _mm256_cmp_ps(z, eoc, _CMP_GT_OQ);
+    int mask;
+
+    vy = _mm256_sub_ps(vy, _mm256_and_ps(off, yacc));
+    y = _mm256_fmadd_ps(vy, dt, y);
+    z = _mm256_fmadd_ps(vz, dt, z);
+    vy = _mm256_sub_ps(vy, _mm256_andnot_ps(off, vacc));
+    vz = _mm256_add_ps(vz, _mm256_andnot_ps(off, hacc));
+
+    _mm256_storeu_ps(p->y + i, y);
+    _mm256_storeu_ps(p->z + i, z);
+    _mm256_storeu_ps(p->vy + i, vy);
+    _mm256_storeu_ps(p->vz + i, vz);
+
+    mask = _mm256_movemask_ps(
+        _mm256_and_ps(off, _mm256_cmp_ps(y, dia, _CMP_LE_OQ)));
+    hits[(i - begin) >> 3] = (unsigned char) mask;
+    hit_count += __builtin_popcount(mask);
+  }
+
+  /* remainder */
+  if(i < end) {
+    unsigned char tail;
+    hit_count += water_kernel_scalar(s, p, i, end, &tail);
+    hits[(i - begin) >> 3] = tail;
+  }
+  return hit_count;
+}
+
+__attribute__((target("sse2")))
+static int water_kernel_sse(struct water_step const *s, struct particles *p,
+                            int begin, int end, unsigned char *hits) {
+  __m128 const dt = _mm_set1_ps(s->elapsed);
+  __m128 const eoc = _mm_set1_ps(s->end_of_chute);
+  __m128 const yacc = _mm_set1_ps(s->y_acceleration);
+  __m128 const vacc = _mm_set1_ps(s->vert_acc);
+  __m128 const hacc = _mm_set1_ps(s->horiz_acc);
+  __m128 const dia = _mm_set1_ps(s->dia);
+  int i, half, hit_count = 0;
+
+  /* 8 particles per iteration as two halves, so the hit mask is one byte */
+  for(i = begin; i + 8 <= end; i += 8) {
+    int mask = 0;
+
+    for(half = 0; half < 8; half += 4) {
+      __m128 y = _mm_loadu_ps(p->y + i + half);
+      __m128 z = _mm_loadu_ps(p->z + i + half);
+      __m128 vy = _mm_loadu_ps(p->vy + i + half);
+      __m128 vz = _mm_loadu_ps(p->vz + i + half);
+      __m128 const off = _mm_cmpgt_ps(z, eoc);
+
+      vy = _mm_sub_ps(vy, _mm_and_ps(off, yacc));
+      y = _mm_add_ps(y, _mm_mul_ps(vy, dt));
+      z = _mm_add_ps(z, _mm_mul_ps(vz, dt));
+      vy = _mm_sub_ps(vy, _mm_andnot_ps(off, vacc));
+      vz = _mm_add_ps(vz, _mm_andnot_ps(off, hacc));
+
+      _mm_storeu_ps(p->y + i + half, y);
+      _mm_storeu_ps(p->z + i + half, z);
+      _mm_storeu_ps(p->vy + i + half, vy);
+      _mm_storeu_ps(p->vz + i + half, vz);
+
+      mask |= _mm_movemask_ps(_mm_and_ps(off, _mm_cmple_ps(y, dia))) << half;
+    }
+    hits[(i - begin) >> 3] = (unsigned char) mask;
+    hit_count += __builtin_popcount(mask);
+  }
+
+  /* remainder */
+  if(i < end) {
+    unsigned char tail;
+    hit_count += water_kernel_scalar(s, p, i, end, &tail);
+    hits[(i - begin) >> 3] = tail;
+  }
+  return hit_count;
+}
+
+#endif /* WATER_KERNEL_X86 */
+
+void init_water_kernel() {
+  char const * const requested = getenv("WATER_KERNEL");
+
+  water_kernel = water_kernel_scalar;
+  water_kernel_name = "scalar";
+  if(requested && strcmp(requested, "scalar") == 0)
+    return;
+
+#ifdef WATER_KERNEL_X86
+  __builtin_cpu_init();
+  if((!requested || strcmp(requested, "avx2") == 0) &&
+     __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    water_kernel = water_kernel_avx2;
+    water_kernel_name = "avx2";
+  } else if(__builtin_cpu_supports("sse2")) {
+    water_kernel = water_kernel_sse;
+    water_kernel_name = "sse";
+  }
+#endif
+
+  if(requested && strcmp(requested, water_kernel_name) != 0)
+    fprintf(stderr, "WARNING: %s water kernel unavailable, using %s\n",
+            requested, water_kernel_name);
+}
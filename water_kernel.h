@@ -0,0 +1,32 @@
+#ifndef water_kernel_h
+#define water_kernel_h
+
+#include "water.h"
+
+/* Per-step constants for the integration kernels */
+struct water_step {
+  GLfloat elapsed;
+  GLfloat end_of_chute;     /* particles beyond this z have left the chute */
+  GLfloat y_acceleration;   /* gravity once off the chute */
+  GLfloat vert_acc;         /* acceleration down the chute */
+  GLfloat horiz_acc;
+  GLfloat dia;              /* particles below this height hit the tray */
+};
+
+/* Integrate particles [begin, end) over one step.  Bit (i & 7) of
+ * hits[i >> 3], counting i from begin, is set for each particle that has
+ * fallen off the chute and reached the tray.  Returns the number of hits. */
+typedef int (*water_kernel_fn)(struct water_step const *, struct particles *,
+                               int, int, unsigned char *);
+
+extern water_kernel_fn water_kernel;
+extern char const * water_kernel_name;
+
+/* Select the widest kernel the CPU supports.  The WATER_KERNEL environment
+ * variable ("scalar", "sse" or "avx2") overrides the choice. */
+void init_water_kernel(void);
+
+int water_kernel_scalar(struct water_step const *, struct particles *,
+                        int, int, unsigned char *);
+
+#endif /* water_kernel_h */
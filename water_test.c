@@ -0,0 +1,92 @@
+/* vi:set sw=2 ts=2 et: */
+
+/* Checks on the water's stores, run by make test.
+ *
+ * A flow of interacting particles is stepped, then mostly taken away and
+ * stepped again: the arrays of the store must stay in its arena throughout,
+ * and the memory of the store and of the interaction must fall back with
+ * the particles. */
+
+#include <stdio.h>
+#include "3dtree.h"
+#include "water.h"
+#include "sph.h"
+#include "timer.h"
+#include "rng.h"
+
+#define test_particles          50000
+#define test_left               1000    /* particles kept for the second run */
+#define test_steps              5
+#define test_capacity           (test_particles + test_particles/8)
+
+static int failures = 0;
+
+static void fail(char const *what) {
+  fprintf(stderr, "ERROR: %s\n", what);
+  failures++;
+}
+
+/* Fill the store with n particles spread out along their paths, the way a
+ * running flow would be */
+static void fill_water(int n) {
+  GLfloat const wh = container_water_level - door_frame[0][1];
+  struct rng r;
+  GLfloat age;
+  int i;
+
+  rng_seed(&r, 1);
+  emit_particles(&water, 0, n, wh, &r);
+  water.count = n;
+  for(i = 0; i < n; i++) {
+    age = 0.6 * rng_float(&r);
+    water.y[i] += water.vy[i] * age;
+    water.z[i] += water.vz[i] * age;
+  }
+}
+
+/* Every array of a store should lie in the store's own arena, whatever the
+ * steps have done with them */
+static void check_arena(struct particles const *p) {
+  GLfloat const * const arrays[] = {p->x, p->y, p->z, p->vx, p->vy, p->vz};
+  char const * const first = (char const *) p->arena;
+  char const * const last = first + p->arena_size;
+  int i;
+
+  for(i = 0; i < 6; i++)
+    if((char const *) arrays[i] < first ||
+       (char const *) (arrays[i] + p->capacity) > last)
+      fail("a particle array is outside its arena");
+}
+
+static void run(int steps) {
+  int i;
+
+  for(i = 0; i < steps; i++)
+    calculate_water(sim_step);
+  check_arena(&water);
+}
+
+int main(void) {
+  size_t full_water, full_sph;
+
+  init_door_frame();
+  water_interact = 1;
+  init_water(test_capacity, 1, 1);
+  doory = 0.5;
+
+  fill_water(test_particles);
+  run(test_steps);
+  full_water = particles_memory(&water);
+  full_sph = sph_memory();
+
+  water.count = test_left;
+  run(test_steps);
+  if(particles_memory(&water) >= full_water)
+    fail("the particles' memory was not given back");
+  if(sph_memory() >= full_sph)
+    fail("the interaction's memory was not given back");
+
+  if(failures > 0) return 1;
+  printf("water_test: passed\n");
+  return 0;
+}